@@ -0,0 +1,348 @@
+#include "backend.h"
+
+#include <fmt/format.h>
+
+#include "hostregs.h"
+#include "registers.h"
+
+static void dump(uint8_t A, uint8_t X, uint8_t Y, uint8_t status) {
+	fmt::print("A: 0x{:X}, X: 0x{:X}, Y: 0x{:X}, Status: 0b{:B}\n", A, X, Y, status);
+}
+
+// Print the guest registers from generated code, for debugging
+__attribute__((unused))
+static void emitDump(asmjit::X86Assembler& a) {
+	a.mov(asmjit::x86::dil, REG_A);
+	a.mov(asmjit::x86::sil, REG_X);
+	a.mov(asmjit::x86::dl, REG_Y);
+	a.mov(asmjit::x86::cl, REG_S);
+	a.call((uint64_t)&dump);
+}
+
+template<class T>
+static void virtual_push(asmjit::X86Assembler& a, MemoryMapper& m, T value) {
+	a.mov(REG_TMP, 0x0100);
+	// @CLEANUP TMP is rax, but we can't or with a larger register
+	a.add(asmjit::x86::al, REG_SP);
+	m.emitDynamicStore(a, REG_TMP, value);
+	a.dec(REG_SP);
+}
+
+template<class T>
+static void virtual_pop(asmjit::X86Assembler& a, MemoryMapper& m, T dst) {
+	a.inc(REG_SP);
+	a.mov(REG_TMP, 0x0100);
+	// @CLEANUP TMP is rax, but we can't or with a larger register
+	a.add(asmjit::x86::al, REG_SP);
+	if(m.isFast(0x0100, 0x01FF))
+		m.emitFastLoad(a, REG_TMP, dst);
+	else
+		m.emitDynamicLoad(a, REG_TMP, dst);
+}
+
+asmjit::X86Gp Backend::reg(IrReg reg) {
+	switch(reg) {
+		case IR_A:  return REG_A;
+		case IR_X:  return REG_X;
+		case IR_Y:  return REG_Y;
+		case IR_SP: return REG_SP;
+		case IR_T0: return REG_T0;
+		case IR_T1: return REG_T1;
+		default:
+			throw std::logic_error("IR instruction is missing a register");
+	}
+}
+
+// N and Z of an 8 bit result are exactly what test leaves in SF and ZF
+// Bit of an IR temporary in a mask of them
+static uint8_t tempBit(IrReg reg) {
+	switch(reg) {
+		case IR_T0: return 1 << 0;
+		case IR_T1: return 1 << 1;
+		default:    return 0;
+	}
+}
+
+static uint8_t tempsRead(const IrInstr& i) {
+	switch(i.op) {
+		case IrOp::NOP:
+		case IrOp::LOAD_IMM:
+		case IrOp::LOAD:
+		case IrOp::POP:
+		case IrOp::LABEL:
+			return 0;
+		case IrOp::MOV:
+		case IrOp::FLAGS_VN:
+		case IrOp::LOAD_IDX:
+		case IrOp::STORE:
+		case IrOp::PUSH:
+			return tempBit(i.src);
+		default:
+			return tempBit(i.dst) | tempBit(i.src) | tempBit(i.src2);
+	}
+}
+
+static uint8_t tempsWritten(const IrInstr& i) {
+	switch(i.op) {
+		case IrOp::LOAD_IMM:
+		case IrOp::MOV:
+		case IrOp::AND:
+		case IrOp::OR:
+		case IrOp::XOR:
+		case IrOp::LOAD:
+		case IrOp::LOAD_IDX:
+		case IrOp::POP:
+			return tempBit(i.dst);
+		default:
+			return 0;
+	}
+}
+
+// Whether the x86 code for the instruction might end up in a helper call
+static bool mayCallHelper(const IrInstr& i) {
+	switch(i.op) {
+		case IrOp::LOAD:
+		case IrOp::LOAD_IDX:
+		case IrOp::STORE:
+		case IrOp::STORE_IDX:
+		case IrOp::PUSH:
+		case IrOp::POP:
+		case IrOp::PUSH_FLAGS:
+		case IrOp::POP_FLAGS:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Copy the temporaries in mask between their registers and the spill slots
+void Backend::emitSpill(uint8_t mask, bool fill) {
+	IrReg temps[] = {IR_T0, IR_T1};
+	for(size_t n = 0; n < 2; n++) {
+		if(!(mask & tempBit(temps[n])))
+			continue;
+		auto slot = asmjit::x86::byte_ptr(REG_CTX, offsetof(CpuContext, spill) + n);
+		if(fill)
+			a.mov(reg(temps[n]), slot);
+		else
+			a.mov(slot, reg(temps[n]));
+	}
+}
+
+void Backend::emitNZ(const IrInstr& instr, asmjit::X86Gp reg) {
+	if((instr.flags & ((1 << S_ZERO) | (1 << S_NEGATIVE))) == 0)
+		return;
+	a.test(reg, reg);
+	emitLogicFlags(instr);
+}
+
+// The logic ops leave the 6502 N and Z in SF and ZF
+void Backend::emitLogicFlags(const IrInstr& instr) {
+	if(instr.flags & (1 << S_ZERO))
+		e.setFlag(S_ZERO, Emitter::FLAG_HOST_Z);
+	if(instr.flags & (1 << S_NEGATIVE))
+		e.setFlag(S_NEGATIVE, Emitter::FLAG_HOST_S);
+}
+
+void Backend::emit(const IrBlock& block) {
+	auto& instrs = block.instrs;
+
+	// Temporaries that are still needed after each instruction. They never
+	// live across the end of a block or a loop head.
+	std::vector<uint8_t> liveAfter(instrs.size());
+	uint8_t live = 0;
+	for(size_t n = instrs.size(); n-- > 0;) {
+		liveAfter[n] = live;
+		live = (live & ~tempsWritten(instrs[n])) | tempsRead(instrs[n]);
+	}
+
+	int32_t location = -1;
+	pending = 0;
+	for(size_t n = 0; n < instrs.size(); n++) {
+		auto& instr = instrs[n];
+		pending += instr.cycles;
+		if(instr.location != location) {
+			location = instr.location;
+			a.comment(fmt::format("; {:X}", location).c_str());
+		}
+		a.comment(fmt::format(";   {}", instr.format()).c_str());
+
+		// Helpers are free to use the registers the temporaries are in
+		uint8_t spilled = mayCallHelper(instr) ? liveAfter[n] & ~tempsWritten(instr) : 0;
+		emitSpill(spilled, false);
+		emit(instr);
+		emitSpill(spilled, true);
+	}
+}
+
+void Backend::emit(const IrInstr& i) {
+	// Anything touching the host flags needs the pending ones out of the way
+	// first
+	if(i.clobbersHostFlags())
+		e.materialize();
+
+	switch(i.op) {
+		case IrOp::NOP:
+			break;
+		case IrOp::LOAD_IMM:
+			a.mov(reg(i.dst), i.imm);
+			// We know the value at compile time, so just emit the right thing
+			if(i.flags & (1 << S_ZERO))
+				e.setFlag(S_ZERO, (i.imm & 0xFF) == 0);
+			if(i.flags & (1 << S_NEGATIVE))
+				e.setFlag(S_NEGATIVE, (i.imm & 0x80) != 0);
+			break;
+		case IrOp::MOV:
+			a.mov(reg(i.dst), reg(i.src));
+			emitNZ(i, reg(i.dst));
+			break;
+		case IrOp::AND:
+			if(i.src == IR_NONE)
+				a.and_(reg(i.dst), i.imm);
+			else
+				a.and_(reg(i.dst), reg(i.src));
+			emitLogicFlags(i);
+			break;
+		case IrOp::OR:
+			if(i.src == IR_NONE)
+				a.or_(reg(i.dst), i.imm);
+			else
+				a.or_(reg(i.dst), reg(i.src));
+			emitLogicFlags(i);
+			break;
+		case IrOp::XOR:
+			if(i.src == IR_NONE)
+				a.xor_(reg(i.dst), i.imm);
+			else
+				a.xor_(reg(i.dst), reg(i.src));
+			emitLogicFlags(i);
+			break;
+		case IrOp::TEST:
+			if(i.src == IR_NONE)
+				a.test(reg(i.dst), i.imm);
+			else
+				a.test(reg(i.dst), reg(i.src));
+			emitLogicFlags(i);
+			break;
+		case IrOp::CMP:
+			if(i.src == IR_NONE)
+				a.cmp(reg(i.dst), i.imm);
+			else
+				a.cmp(reg(i.dst), reg(i.src));
+			// The 6502 carry is the inverse of the x86 borrow
+			if(i.flags & (1 << S_CARRY))
+				e.setFlag(S_CARRY, Emitter::FLAG_HOST_NC);
+			if(i.flags & (1 << S_ZERO))
+				e.setFlag(S_ZERO, Emitter::FLAG_HOST_Z);
+			if(i.flags & (1 << S_NEGATIVE))
+				e.setFlag(S_NEGATIVE, Emitter::FLAG_HOST_S);
+			break;
+		case IrOp::FLAGS_VN: {
+			// V and N are bit 6 and 7 of the operand, which is where they
+			// live in the status register too
+			uint8_t copied = i.flags & ((1 << S_OVERFLOW) | (1 << S_NEGATIVE));
+			if(copied == 0)
+				break;
+			a.and_(REG_S, (uint8_t)~copied);
+			a.mov(asmjit::x86::cl, reg(i.src));
+			a.and_(asmjit::x86::cl, copied);
+			a.or_(REG_S, asmjit::x86::cl);
+			break;
+		}
+		case IrOp::LOAD:
+			m.emitLoad(a, i.imm, reg(i.dst));
+			emitNZ(i, reg(i.dst));
+			break;
+		case IrOp::LOAD_IDX:
+			// The carry out of the low byte is the extra cycle for crossing
+			// a page
+			if(i.imm & 0xFF) {
+				a.mov(asmjit::x86::al, i.imm & 0xFF);
+				a.add(asmjit::x86::al, reg(i.src));
+				a.sbb(asmjit::x86::qword_ptr(REG_CTX, offsetof(CpuContext, budget)), 0);
+			}
+			a.movzx(asmjit::x86::eax, reg(i.src));
+			a.add(asmjit::x86::ax, i.imm);
+			// Anything the index can reach is in ROM right now, so it will
+			// most likely stay that way
+			if(m.isFast(i.imm, i.imm + 0xFF))
+				m.emitFastLoad(a, REG_TMP, reg(i.dst));
+			else
+				m.emitDynamicLoad(a, REG_TMP, reg(i.dst));
+			emitNZ(i, reg(i.dst));
+			break;
+		case IrOp::STORE:
+			m.emitStore(a, i.imm, reg(i.src));
+			break;
+		case IrOp::STORE_IDX:
+			a.movzx(asmjit::x86::eax, reg(i.src2));
+			a.add(asmjit::x86::ax, i.imm);
+			m.emitDynamicStore(a, REG_TMP, reg(i.src));
+			break;
+		case IrOp::PUSH:
+			if(i.src == IR_NONE)
+				virtual_push(a, m, static_cast<uint8_t>(i.imm));
+			else
+				virtual_push(a, m, reg(i.src));
+			break;
+		case IrOp::POP:
+			virtual_pop(a, m, reg(i.dst));
+			break;
+		case IrOp::PUSH_FLAGS:
+			// The pushed copy always has the break bit set
+			a.mov(asmjit::x86::cl, REG_S);
+			a.or_(asmjit::x86::cl, 1 << S_INTERRUPT);
+			virtual_push(a, m, asmjit::x86::cl);
+			break;
+		case IrOp::POP_FLAGS:
+			virtual_pop(a, m, REG_S);
+			// The break bit doesn't exist in the real register
+			a.btr(REG_S, S_INTERRUPT);
+			a.bts(REG_S, S_ALWAYS);
+			break;
+		case IrOp::SET_FLAG:
+			e.setFlag(i.flag, i.value);
+			break;
+		case IrOp::BRANCH: {
+			// A taken branch costs a cycle, and another one if it lands on a
+			// different page than the instruction after it
+			uint32_t taken = pending + 1;
+			if((i.target & 0xFF00) != ((i.location + 2) & 0xFF00))
+				taken++;
+
+			auto NotTaken = a.newLabel();
+			e.jumpIf(i.flag, !i.value, NotTaken);
+			if(i.local)
+				e.loop(heads.at(i.target), i.target, taken);
+			else
+				e.exit(i.target, taken);
+			a.bind(NotTaken);
+			break;
+		}
+		case IrOp::JUMP:
+			if(i.local)
+				e.loop(heads.at(i.target), i.target, pending);
+			else
+				e.exit(i.target, pending);
+			pending = 0;
+			break;
+		case IrOp::LABEL: {
+			// Everything after the head is paid for again on every iteration
+			e.spend(pending);
+			pending = 0;
+			auto head = a.newLabel();
+			a.bind(head);
+			heads[i.target] = head;
+			break;
+		}
+		case IrOp::JUMP_IND:
+			a.movzx(asmjit::x86::edi, reg(i.src2));
+			a.shl(asmjit::x86::edi, 8);
+			a.movzx(asmjit::x86::eax, reg(i.src));
+			a.or_(asmjit::x86::edi, asmjit::x86::eax);
+			a.add(asmjit::x86::di, i.imm);
+			e.exitIndirect(pending);
+			pending = 0;
+			break;
+	}
+}
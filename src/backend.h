@@ -0,0 +1,30 @@
+#pragma once
+
+#include <unordered_map>
+#include <asmjit/asmjit.h>
+
+#include "emitter.h"
+#include "ir.h"
+#include "mapper/memorymapper.h"
+
+// Lowers the IR of a block to x86. Flags and exits are left to the Emitter.
+class Backend {
+	private:
+		asmjit::X86Assembler& a;
+		MemoryMapper& m;
+		Emitter& e;
+		// Bound labels of the loop heads emitted so far
+		std::unordered_map<uint16_t, asmjit::Label> heads;
+		// Guest cycles run through since they were last taken off the budget
+		uint32_t pending;
+
+		asmjit::X86Gp reg(IrReg reg);
+		void emitSpill(uint8_t mask, bool fill);
+		void emitLogicFlags(const IrInstr& instr);
+		void emitNZ(const IrInstr& instr, asmjit::X86Gp reg);
+		void emit(const IrInstr& instr);
+	public:
+		Backend(asmjit::X86Assembler& a, MemoryMapper& m, Emitter& e) : a(a), m(m), e(e), pending(0) {};
+
+		void emit(const IrBlock& block);
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "mapper/memorymapper.h"
+
+// Signature of the generated function.
+typedef void (*Func)(void);
+
+class Block;
+
+// A place where a compiled block leaves for another guest address. The slot
+// holds the host address the exit jumps to, which is jit_and_jump until the
+// code cache links it directly to the compiled successor.
+struct Exit {
+	Block* from;
+	uint16_t target;
+	uint64_t* slot;
+	Block* linked;
+};
+
+// Guest bytes [start, end) a block was decoded from. end wraps to 0 for a
+// range running up to 0xFFFF.
+struct Range {
+	uint16_t start;
+	uint16_t end;
+};
+
+class Block {
+	public:
+		uint16_t start;
+		// What was mapped at the page of start when the block was decoded.
+		// Set by the CodeCache.
+		PageSource source;
+		// Where execution continues if the last instruction falls through
+		uint16_t end;
+		// A trace follows jumps and branches, so it can be made up of several
+		// disjoint pieces of guest code
+		std::vector<Range> ranges;
+		std::shared_ptr<std::vector<std::unique_ptr<Instr>>> instrs;
+		// Guest address of each instruction in instrs
+		std::vector<uint16_t> locations;
+		// Base cycles of each instruction in instrs, see opcodeCycles
+		std::vector<uint8_t> cycles;
+		// Null until the block is hot enough to be compiled
+		Func fn;
+		// Times the block has been run by the interpreter
+		uint32_t runs;
+		// False for blocks that can only ever be interpreted
+		bool compilable;
+
+		// Exits out of this block. Never resized after the block is
+		// compiled, other blocks keep pointers into it.
+		std::vector<Exit> exits;
+		// Exits in other blocks that are linked directly to this one
+		std::vector<Exit*> incoming;
+
+		Block(uint16_t start) :
+			start(start),
+			source(),
+			end(start),
+			instrs(std::make_shared<std::vector<std::unique_ptr<Instr>>>()),
+			fn(nullptr),
+			runs(0),
+			compilable(true) {};
+
+		bool contains(uint16_t addr) {
+			for(auto& range : ranges) {
+				if((uint16_t)(addr - range.start) < (uint16_t)(range.end - range.start))
+					return true;
+			}
+			return false;
+		}
+};
@@ -0,0 +1,56 @@
+#include "codearena.h"
+
+#include <stdexcept>
+#include <sys/mman.h>
+
+// Blocks start on a cache line, like the runtime used to place them
+#define BLOCK_ALIGNMENT 64
+
+CodeArena::CodeArena(size_t capacity) :
+	capacity(capacity),
+	used(0),
+	resets(0) {
+	// Exits are patched in place, so the code has to stay writable
+	void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(mapping == MAP_FAILED)
+		throw std::runtime_error("Could not map the code arena");
+	base = (uint8_t*)mapping;
+}
+
+CodeArena::~CodeArena() {
+	munmap(base, capacity);
+}
+
+Func CodeArena::add(asmjit::CodeHolder& code) {
+	// Trampolines for calls that end up out of range are included
+	size_t size = code.getCodeSize();
+	size_t start = (used + BLOCK_ALIGNMENT - 1) & ~(size_t)(BLOCK_ALIGNMENT - 1);
+	if(size == 0 || start + size > capacity)
+		return nullptr;
+
+	uint8_t* memory = base + start;
+	size_t relocated = code.relocate(memory, (uint64_t)memory);
+	if(relocated == 0)
+		return nullptr;
+	used = start + relocated;
+	return (Func)memory;
+}
+
+void CodeArena::reset() {
+	used = 0;
+	resets++;
+	// Give the pages back, the next fill touches them again anyway
+	madvise(base, capacity, MADV_DONTNEED);
+}
+
+size_t CodeArena::getUsed() {
+	return used;
+}
+
+size_t CodeArena::getCapacity() {
+	return capacity;
+}
+
+uint64_t CodeArena::getResets() {
+	return resets;
+}
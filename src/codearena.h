@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <asmjit/asmjit.h>
+
+#include "block.h"
+
+// One big executable mapping that compiled blocks are bump allocated from.
+// Nothing is freed on its own. Once the arena is full the whole code cache
+// is flushed and the arena starts over, see CodeCache::flush.
+class CodeArena {
+	private:
+		uint8_t* base;
+		size_t capacity;
+		size_t used;
+		uint64_t resets;
+	public:
+		// Reserve capacity bytes. The memory is only backed as it is used.
+		CodeArena(size_t capacity);
+		~CodeArena();
+
+		// Copy the code into the arena and relocate it there. Returns null
+		// if there isn't room for it.
+		Func add(asmjit::CodeHolder& code);
+		// Forget everything that was allocated. Only safe when no generated
+		// code is running and nothing links to it any more.
+		void reset();
+
+		size_t getUsed();
+		size_t getCapacity();
+		uint64_t getResets();
+};
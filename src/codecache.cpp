@@ -0,0 +1,302 @@
+#include "codecache.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/format.h>
+
+extern "C" uint64_t jit_and_jump();
+
+Func* jit_dispatch_pages[0x100];
+uint64_t jit_dispatch_hits;
+uint8_t jit_exit_requested;
+
+// Where pages without a partition point
+static DispatchPage emptyDispatch;
+
+// Upper bound on the number of partitions kept around. Each one costs a few
+// K on top of its code.
+#define MAX_PARTITIONS 1024
+
+// Calls f once for every guest page the block was decoded from
+template<class F>
+static void forEachPage(Block* block, F f) {
+	bool seen[0x100] = {};
+	for(auto& range : block->ranges) {
+		// end is exclusive and wraps to 0 for a range running up to 0xFFFF.
+		// A range can also run past 0xFFFF into page 0.
+		uint16_t last = range.end - 1;
+		uint8_t count = (uint8_t)((last >> 8) - (range.start >> 8));
+		uint8_t page = range.start >> 8;
+		for(uint16_t i = 0; i <= count; i++, page++) {
+			if(seen[page])
+				continue;
+			seen[page] = true;
+			f(page);
+		}
+	}
+}
+
+CodeCache::CodeCache(CodeArena& arena, MemoryMapper& mapper) :
+	arena(arena),
+	mapper(mapper),
+	active(),
+	switches(0),
+	hits(0),
+	misses(0) {
+	for(auto& page : jit_dispatch_pages)
+		page = emptyDispatch;
+	mapper.setWatcher(this);
+}
+
+CodeCache::~CodeCache() {
+	mapper.setWatcher(nullptr);
+	collect();
+	for(auto& page : jit_dispatch_pages)
+		page = emptyDispatch;
+	for(auto& entry : partitions) {
+		for(auto& block : entry.second->blocks) {
+			if(block != nullptr)
+				release(block);
+		}
+	}
+}
+
+void CodeCache::release(std::unique_ptr<Block>& block) {
+	// The code itself is only given back by flush()
+	block.reset();
+}
+
+Block* CodeCache::find(uint16_t pc) {
+	Partition* partition = active[pc >> 8];
+	return partition != nullptr ? partition->blocks[pc & 0xFF].get() : nullptr;
+}
+
+Partition& CodeCache::partition(uint8_t page) {
+	if(active[page] != nullptr)
+		return *active[page];
+
+	if(partitions.size() >= MAX_PARTITIONS)
+		evictOldest();
+
+	PartitionKey key = {page, mapper.getSource(page)};
+	auto created = std::make_unique<Partition>();
+	created->key = key;
+	created->used = switches;
+	Partition* result = created.get();
+	partitions[key] = std::move(created);
+
+	active[page] = result;
+	jit_dispatch_pages[page] = result->dispatch;
+	return *result;
+}
+
+bool CodeCache::linkable(Block* from, Block* target) {
+	uint8_t page = target->start >> 8;
+	if(!mapper.isSwitchable(page))
+		return true;
+	// The blocks of a partition are switched out together, so from can never
+	// run while target isn't mapped. Whatever find() returns for the page
+	// right now doesn't matter, exits waiting in unlinked can come from a
+	// partition that isn't mapped.
+	PartitionKey fromKey = {(uint8_t)(from->start >> 8), from->source};
+	PartitionKey targetKey = {page, target->source};
+	return fromKey == targetKey;
+}
+
+Block* CodeCache::lookup(uint16_t pc) {
+	Block* block = find(pc);
+	if(block == nullptr) {
+		misses++;
+		return nullptr;
+	}
+	hits++;
+	return block;
+}
+
+void CodeCache::patch(Exit& exit, Block* target) {
+	exit.linked = target;
+	if(target == nullptr) {
+		*exit.slot = (uint64_t)&jit_and_jump;
+		unlinked[exit.target].push_back(&exit);
+	} else {
+		// A direct jump into another bank would run the wrong guest code
+		// once the bank of from is mapped again
+		if(!linkable(exit.from, target))
+			throw std::logic_error("Exit linked across banks");
+		*exit.slot = (uint64_t)target->fn;
+		target->incoming.push_back(&exit);
+	}
+}
+
+Block* CodeCache::insert(std::unique_ptr<Block> block) {
+	block->source = mapper.getSource(block->start >> 8);
+	auto& slot = partition(block->start >> 8).blocks[block->start & 0xFF];
+	if(slot != nullptr)
+		invalidate(slot.get());
+	slot = std::move(block);
+	Block* inserted = slot.get();
+
+	// Decoded instructions go stale just like compiled code does
+	forEachPage(inserted, [&](uint8_t page) {
+		pages[page].push_back(inserted);
+		mapper.watch(page, true);
+	});
+
+	if(inserted->fn != nullptr)
+		compiled(inserted);
+	return inserted;
+}
+
+void CodeCache::compiled(Block* block) {
+	partition(block->start >> 8).dispatch[block->start & 0xFF] = block->fn;
+
+	// Link our own exits to whatever is already compiled
+	for(auto& exit : block->exits) {
+		Block* target = find(exit.target);
+		bool link = target != nullptr && target->fn != nullptr && linkable(block, target);
+		patch(exit, link ? target : nullptr);
+	}
+
+	// And everyone that was waiting for us
+	auto waiting = unlinked.find(block->start);
+	if(waiting != unlinked.end()) {
+		auto exits = std::move(waiting->second);
+		unlinked.erase(waiting);
+		for(Exit* exit : exits)
+			patch(*exit, linkable(exit->from, block) ? block : nullptr);
+	}
+}
+
+uint64_t CodeCache::getHits() {
+	return hits + jit_dispatch_hits;
+}
+
+uint64_t CodeCache::getMisses() {
+	return misses;
+}
+
+void CodeCache::unlink(Block* block) {
+	auto incoming = std::move(block->incoming);
+	block->incoming.clear();
+	for(Exit* exit : incoming)
+		patch(*exit, nullptr);
+}
+
+// Remove every reference to the block from the link bookkeeping
+void CodeCache::detach(Block* block) {
+	unlink(block);
+
+	for(auto& exit : block->exits) {
+		if(exit.linked != nullptr) {
+			auto& incoming = exit.linked->incoming;
+			incoming.erase(std::remove(incoming.begin(), incoming.end(), &exit), incoming.end());
+		} else {
+			auto waiting = unlinked.find(exit.target);
+			if(waiting == unlinked.end())
+				continue;
+			auto& exits = waiting->second;
+			exits.erase(std::remove(exits.begin(), exits.end(), &exit), exits.end());
+			if(exits.empty())
+				unlinked.erase(waiting);
+		}
+	}
+}
+
+void CodeCache::invalidate(Block* block) {
+	// Runs for every store into watched code, so keep quiet
+	drop(block);
+}
+
+void CodeCache::drop(Block* block) {
+	detach(block);
+	// The block might be looping on itself right now
+	jit_exit_requested = 1;
+
+	forEachPage(block, [&](uint8_t page) {
+		auto& blocks = pages[page];
+		blocks.erase(std::remove(blocks.begin(), blocks.end(), block), blocks.end());
+		if(blocks.empty())
+			mapper.watch(page, false);
+	});
+
+	auto& partition = partitions.at({(uint8_t)(block->start >> 8), block->source});
+	partition->dispatch[block->start & 0xFF] = nullptr;
+	graveyard.push_back(std::move(partition->blocks[block->start & 0xFF]));
+}
+
+void CodeCache::evict(Partition& partition) {
+	for(auto& block : partition.blocks) {
+		if(block != nullptr)
+			drop(block.get());
+	}
+
+	PartitionKey key = partition.key;
+	if(active[key.page] == &partition) {
+		active[key.page] = nullptr;
+		jit_dispatch_pages[key.page] = emptyDispatch;
+	}
+	partitions.erase(key);
+}
+
+bool CodeCache::evictOldest() {
+	Partition* oldest = nullptr;
+	for(auto& entry : partitions) {
+		Partition* partition = entry.second.get();
+		if(active[partition->key.page] == partition)
+			continue;
+		if(oldest == nullptr || partition->used < oldest->used)
+			oldest = partition;
+	}
+	if(oldest == nullptr)
+		return false;
+	fmt::print("Evicting the blocks of page {:X}\n", oldest->key.page);
+	evict(*oldest);
+	return true;
+}
+
+void CodeCache::collect() {
+	for(auto& block : graveyard)
+		release(block);
+	graveyard.clear();
+}
+
+void CodeCache::flush() {
+	fmt::print("Flushing the code cache, {} bytes of code\n", arena.getUsed());
+	while(!partitions.empty())
+		evict(*partitions.begin()->second);
+	// Nothing refers to the old code any more, dropping a block unlinks it
+	// from everything else. The blocks themselves are left for collect(),
+	// the caller might still be holding on to one.
+	arena.reset();
+}
+
+void CodeCache::written(uint16_t addr) {
+	// Back to front, invalidating a block only takes that one out of the
+	// list. Most stores hit data next to the code, so nothing is copied.
+	auto& blocks = pages[addr >> 8];
+	for(size_t i = blocks.size(); i-- > 0;) {
+		Block* block = blocks[i];
+		// Blocks from a bank that isn't mapped right now weren't written to
+		if(!(block->source == mapper.getSource(block->start >> 8)))
+			continue;
+		if(block->contains(addr))
+			invalidate(block);
+	}
+}
+
+void CodeCache::mapped(uint8_t page, uint16_t count) {
+	switches++;
+	for(uint16_t i = 0; i < count; i++) {
+		uint8_t remapped = page + i;
+		if(active[remapped] != nullptr)
+			active[remapped]->used = switches;
+
+		// Whatever was compiled for the new mapping before is still there
+		auto found = partitions.find({remapped, mapper.getSource(remapped)});
+		Partition* partition = found != partitions.end() ? found->second.get() : nullptr;
+		active[remapped] = partition;
+		jit_dispatch_pages[remapped] = partition != nullptr ? partition->dispatch : emptyDispatch;
+		if(partition != nullptr)
+			partition->used = switches;
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include <asmjit/asmjit.h>
+
+#include "block.h"
+#include "codearena.h"
+#include "mapper/memorymapper.h"
+#include "mapper/writewatcher.h"
+
+// Host entry points for a guest page, by the low byte of the PC, or null
+// where there is no compiled code yet
+typedef Func DispatchPage[0x100];
+// The dispatch page of every guest page. Never null, pages without any
+// compiled code point at an empty one. jit_and_jump in fun.S indexes these
+// directly.
+extern "C" Func* jit_dispatch_pages[0x100];
+// Number of times jit_and_jump found its target in the table
+extern "C" uint64_t jit_dispatch_hits;
+// Set to make loops in generated code leave for the compiler at their next
+// back edge. Cleared whenever the compiler is entered.
+extern "C" uint8_t jit_exit_requested;
+
+// A guest page together with the bank memory mapped there
+struct PartitionKey {
+	uint8_t page;
+	PageSource source;
+
+	bool operator==(const PartitionKey& other) const {
+		return page == other.page && source == other.source;
+	}
+};
+
+struct PartitionKeyHash {
+	size_t operator()(const PartitionKey& key) const {
+		return std::hash<uintptr_t>()((uintptr_t)key.source.bank) ^ ((size_t)key.source.offset << 8) ^ key.page;
+	}
+};
+
+// The blocks decoded from a guest page while some piece of bank memory was
+// mapped there
+struct Partition {
+	PartitionKey key;
+	// What jit_dispatch_pages points at while the partition is mapped
+	DispatchPage dispatch;
+	std::unique_ptr<Block> blocks[0x100];
+	// Value of CodeCache::switches when the partition was last mapped in or
+	// out, for picking what to evict
+	uint64_t used;
+};
+
+// Translation cache from guest PC to compiled block, partitioned by what is
+// mapped at the page of the PC. Switching a bank only points the dispatcher
+// at other partitions, so code compiled for a bank is still there when it is
+// switched back in. Partitions that haven't been mapped for a long time are
+// thrown away whole.
+//
+// A block can't tell whether it is still mapped once it is running, so
+// traces never extend into switchable pages other than the one they start
+// in, and exits only get linked to blocks in switchable pages from the same
+// partition.
+//
+// Blocks in writable memory are watched through the MemoryMapper, and a
+// store into the bytes of a block throws just that block away.
+// @COMPLETENESS A block that stores into its own later bytes keeps running
+// its stale code up to its next exit or loop back edge, which is where
+// jit_exit_requested is looked at. Only the next run of it sees the new
+// bytes.
+class CodeCache : public WriteWatcher {
+	private:
+		CodeArena& arena;
+		MemoryMapper& mapper;
+		std::unordered_map<PartitionKey, std::unique_ptr<Partition>, PartitionKeyHash> partitions;
+		// The partition mapped at each guest page, if it has one yet
+		Partition* active[0x100];
+		// Counts bank switches
+		uint64_t switches;
+		// The blocks decoded from each guest page
+		std::vector<Block*> pages[0x100];
+		// Invalidated blocks. They might still be running, so they are only
+		// freed by collect().
+		std::vector<std::unique_ptr<Block>> graveyard;
+		// Exits that still go through the dispatcher, by guest target
+		std::unordered_map<uint16_t, std::vector<Exit*>> unlinked;
+
+		uint64_t hits;
+		uint64_t misses;
+
+		// The block that would run at pc with the current mapping, if any
+		Block* find(uint16_t pc);
+		// The partition of a guest page for the current mapping, created if
+		// there is none
+		Partition& partition(uint8_t page);
+		// Whether exits from from can jump straight into target
+		bool linkable(Block* from, Block* target);
+		void patch(Exit& exit, Block* target);
+		void detach(Block* block);
+		// Take the block out of the cache and put it in the graveyard
+		void drop(Block* block);
+		void release(std::unique_ptr<Block>& block);
+		// Throw away the partition that has been out of use the longest.
+		// Returns false if every partition is mapped.
+		bool evictOldest();
+	public:
+		CodeCache(CodeArena& arena, MemoryMapper& mapper);
+		~CodeCache();
+
+		Block* lookup(uint16_t pc);
+		// Take ownership of a decoded block
+		Block* insert(std::unique_ptr<Block> block);
+		// The block has been given host code. Make it reachable from the
+		// dispatcher and link it with its neighbours.
+		void compiled(Block* block);
+		// Send every exit linked to this block back through the dispatcher
+		void unlink(Block* block);
+		// Drop a block from the cache. Its code stays alive until the next
+		// collect()
+		void invalidate(Block* block);
+		// Drop every block of a partition at once, like invalidate
+		void evict(Partition& partition);
+		// Free invalidated blocks. Only safe when no generated code is running.
+		void collect();
+		// Throw away every block and start the arena over. Only safe when
+		// no generated code is running, like collect().
+		void flush();
+
+		void written(uint16_t addr);
+		void mapped(uint8_t page, uint16_t count);
+
+		uint64_t getHits();
+		uint64_t getMisses();
+};
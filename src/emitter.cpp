@@ -0,0 +1,183 @@
+#include "emitter.h"
+
+#include "block.h"
+#include "hostregs.h"
+#include "registers.h"
+
+extern "C" uint64_t jit_and_jump();
+extern "C" uint64_t jit_leave();
+extern "C" uint8_t jit_exit_requested;
+
+Emitter::Emitter(asmjit::X86Assembler& a) : a(a) {
+	// Everything is in REG_S when a block is entered
+	for(auto& source : flags)
+		source = FLAG_IN_S;
+}
+
+void Emitter::setFlag(int flag, FlagSource source) {
+	flags[flag] = source;
+}
+
+void Emitter::setFlag(int flag, bool value) {
+	setFlag(flag, value ? FLAG_SET : FLAG_CLEAR);
+}
+
+void Emitter::emitFlags() {
+	// Grab everything out of the host flags before anything clobbers them
+	static const asmjit::X86Gp temps[] = {
+		asmjit::x86::al,
+		asmjit::x86::cl,
+		asmjit::x86::dl,
+		asmjit::x86::sil,
+	};
+	asmjit::X86Gp captured[8];
+	int used = 0;
+	uint8_t pending = 0;
+	uint8_t set = 0;
+
+	for(int flag = 0; flag < 8; flag++) {
+		if(flags[flag] == FLAG_IN_S)
+			continue;
+		pending |= 1 << flag;
+
+		auto temp = temps[used];
+		switch(flags[flag]) {
+			case FLAG_HOST_C:  a.setc(temp);  break;
+			case FLAG_HOST_NC: a.setnc(temp); break;
+			case FLAG_HOST_Z:  a.setz(temp);  break;
+			case FLAG_HOST_S:  a.sets(temp);  break;
+			case FLAG_SET:
+				set |= 1 << flag;
+				continue;
+			default:
+				continue;
+		}
+		captured[flag] = temp;
+		used++;
+	}
+
+	if(pending == 0)
+		return;
+
+	a.and_(REG_S, (uint8_t)~pending);
+	for(int flag = 0; flag < 8; flag++) {
+		switch(flags[flag]) {
+			case FLAG_HOST_C:
+			case FLAG_HOST_NC:
+			case FLAG_HOST_Z:
+			case FLAG_HOST_S:
+				if(flag != 0)
+					a.shl(captured[flag], flag);
+				a.or_(REG_S, captured[flag]);
+				break;
+			default:
+				break;
+		}
+	}
+	if(set != 0)
+		a.or_(REG_S, set);
+}
+
+void Emitter::materialize() {
+	emitFlags();
+	for(auto& source : flags)
+		source = FLAG_IN_S;
+}
+
+void Emitter::jumpIf(int flag, bool value, asmjit::Label target) {
+	switch(flags[flag]) {
+		case FLAG_IN_S:
+			// Testing REG_S clobbers the host flags
+			materialize();
+			a.test(REG_S, 1 << flag);
+			if(value)
+				a.jnz(target);
+			else
+				a.jz(target);
+			break;
+		case FLAG_HOST_C:
+			if(value) a.jc(target); else a.jnc(target);
+			break;
+		case FLAG_HOST_NC:
+			if(value) a.jnc(target); else a.jc(target);
+			break;
+		case FLAG_HOST_Z:
+			if(value) a.jz(target); else a.jnz(target);
+			break;
+		case FLAG_HOST_S:
+			if(value) a.js(target); else a.jns(target);
+			break;
+		case FLAG_SET:
+		case FLAG_CLEAR:
+			if((flags[flag] == FLAG_SET) == value)
+				a.jmp(target);
+			break;
+	}
+}
+
+void Emitter::spend(uint32_t cycles) {
+	a.sub(asmjit::x86::qword_ptr(REG_CTX, offsetof(CpuContext, budget)), cycles);
+}
+
+void Emitter::exit(uint16_t target, uint32_t cycles) {
+	// The flags only get written on this path. Whoever jumped around the exit
+	// still sees them pending.
+	emitFlags();
+
+	auto slot = a.newLabel();
+	auto OutOfCycles = a.newLabel();
+
+	a.mov(asmjit::x86::di, target);
+	spend(cycles);
+	a.jle(OutOfCycles);
+	a.jmp(asmjit::x86::qword_ptr(slot));
+
+	// The slot is patched while other code is running, keep it from straddling
+	// a cache line
+	a.align(asmjit::kAlignData, 8);
+	a.bind(slot);
+	uint64_t dispatcher = (uint64_t)&jit_and_jump;
+	a.embed(&dispatcher, sizeof(dispatcher));
+
+	a.bind(OutOfCycles);
+	a.jmp((uint64_t)&jit_leave);
+
+	exits.push_back({target, slot});
+}
+
+void Emitter::exitIndirect(uint32_t cycles) {
+	// Only the cache knows where this goes, so there's nothing to link
+	emitFlags();
+
+	auto OutOfCycles = a.newLabel();
+	spend(cycles);
+	a.jle(OutOfCycles);
+	a.jmp((uint64_t)&jit_and_jump);
+
+	a.bind(OutOfCycles);
+	a.jmp((uint64_t)&jit_leave);
+}
+
+void Emitter::loop(asmjit::Label head, uint16_t location, uint32_t cycles) {
+	emitFlags();
+
+	auto Leave = a.newLabel();
+	spend(cycles);
+	a.jle(Leave);
+	a.mov(asmjit::x86::rax, (uint64_t)&jit_exit_requested);
+	a.cmp(asmjit::x86::byte_ptr(asmjit::x86::rax), 0);
+	a.je(head);
+
+	a.bind(Leave);
+	a.mov(asmjit::x86::di, location);
+	a.jmp((uint64_t)&jit_leave);
+}
+
+void Emitter::resolve(Block& block, asmjit::CodeHolder& code) {
+	uint8_t* base = (uint8_t*)block.fn;
+	block.exits.reserve(exits.size());
+	for(auto& pending : exits) {
+		uint64_t* slot = (uint64_t*)(base + code.getLabelOffset(pending.slot));
+		block.exits.push_back({&block, pending.target, slot, nullptr});
+	}
+}
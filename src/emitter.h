@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <asmjit/asmjit.h>
+
+class Block;
+
+// Per block state while the instructions of a block are being emitted
+class Emitter {
+	public:
+		// Where the current value of a status flag lives. Anything but
+		// FLAG_IN_S still has to be written to REG_S before someone looks
+		// at it there.
+		enum FlagSource {
+			FLAG_IN_S,
+			// The x86 flag, only valid until the next instruction that
+			// changes the host flags
+			FLAG_HOST_C,
+			FLAG_HOST_NC, // Inverted carry, what cmp leaves for the 6502
+			FLAG_HOST_Z,
+			FLAG_HOST_S,
+			// Known at compile time
+			FLAG_CLEAR,
+			FLAG_SET,
+		};
+	private:
+		struct PendingExit {
+			uint16_t target;
+			asmjit::Label slot;
+		};
+
+		asmjit::X86Assembler& a;
+		std::vector<PendingExit> exits;
+		FlagSource flags[8];
+
+		void emitFlags();
+	public:
+		Emitter(asmjit::X86Assembler& a);
+
+		void setFlag(int flag, FlagSource source);
+		void setFlag(int flag, bool value);
+		// Write every pending flag to REG_S. Needed before anything that
+		// changes the host flags or reads REG_S.
+		void materialize();
+		// Jump to target if the flag has the given value
+		void jumpIf(int flag, bool value, asmjit::Label target);
+
+		// Take guest cycles off the budget in the CpuContext
+		void spend(uint32_t cycles);
+
+		// The ways out of a block take the cycles spent on the way there off
+		// the budget, and go back to the compiler instead if that runs out.
+		//
+		// Leave the block for a statically known guest address. The exit goes
+		// through jit_and_jump until the code cache links it. Pending flags are
+		// written out on the way, but stay pending for the code after the exit.
+		void exit(uint16_t target, uint32_t cycles);
+		// Leave the block for the guest address in di
+		void exitIndirect(uint32_t cycles);
+		// Jump back to the head of a loop in the block, which is at guest
+		// location. The flags are written out on the way like for exit().
+		// Leaves for the compiler instead when jit_exit_requested is set.
+		void loop(asmjit::Label head, uint16_t location, uint32_t cycles);
+
+		// Fill in the exits of the block once the code has been placed in
+		// executable memory at block.fn
+		void resolve(Block& block, asmjit::CodeHolder& code);
+};
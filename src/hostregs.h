@@ -0,0 +1,22 @@
+#pragma once
+
+#include <asmjit/asmjit.h>
+
+// Where the guest registers live while generated code is running. They are
+// all callee saved, so helper calls leave them alone. fun.S has to agree
+// with this.
+#define REG_SP asmjit::x86::bl
+#define REG_S  asmjit::x86::bpl
+#define REG_A  asmjit::x86::r13b
+#define REG_X  asmjit::x86::r14b
+#define REG_Y  asmjit::x86::r15b
+
+// Points at the CpuContext for as long as generated code is running
+#define REG_CTX asmjit::x86::r12
+
+#define REG_TMP asmjit::x86::rax
+
+// IR temporaries. They are caller saved, the Backend parks the ones still
+// needed in the CpuContext around anything that might call a helper.
+#define REG_T0 asmjit::x86::r8b
+#define REG_T1 asmjit::x86::r9b
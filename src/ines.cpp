@@ -5,7 +5,7 @@
 #include <fmt/format.h>
 
 #include "mapper/filememorybank.h"
-#include "mapper/remapmemorybank.h"
+#include "mapper/iomemorybank.h"
 #include "mapper/rammemorybank.h"
 
 extern "C" uint64_t foo();
@@ -27,51 +27,92 @@ void ParserPointer::jump(size_t newPointer) {
 	this->m_pointer = newPointer;
 }
 
-INes::INes(std::string path): PrgRomSize(0), ChrRomSize(0), PrgRamSize(0) {
-	std::ifstream fs(path.c_str());
-
-	char magic[5];
-	fs.get(magic, 5);
-	if(strcmp(magic, "NES\x1A") != 0)
-		throw std::runtime_error("Not an ines file");
-	printf("It's an ines file\n");
-
-	char read;
-	fs.get(read);
-	this->PrgRomSize = read;
-
-	fs.get(read);
-	this->ChrRomSize = read;
-
-	//@Expansion: discard for now
-	fs.get(read);
-
-	//@Expansion: discard for now
-	fs.get(read);
-
-	fs.get(read);
-	this->PrgRamSize = read;
-
-	//@Expansion: discard for now
-	fs.get(read);
-
-	//@Expansion: discard for now
-	fs.get(read);
+// A ROM size from the NES 2.0 header. An msb nibble of 0xF means the lsb
+// byte holds an exponent and a multiplier instead of a count of units.
+static size_t romSize(uint8_t lsb, uint8_t msb, size_t unit) {
+	if(msb == 0x0F)
+		return ((size_t)1 << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+	return ((msb << 8) | lsb) * unit;
+}
 
-	//Discard the padding bytes
-	char pad[6];
-	fs.get(pad, 6);
+// NES 2.0 RAM sizes are shift counts, with 0 meaning there is none
+static size_t ramSize(uint8_t shift) {
+	return shift != 0 ? (size_t)64 << shift : 0;
+}
 
-	//@Expansion: Here we could have a bunch of stuff
-	//I'm just going to assume only the essentials are here
-	//At some point we probably need to support all the other
-	//garbage - JJ 16/3 2017
+INes::INes(std::string path):
+	PrgRomSize(0),
+	ChrRomSize(0),
+	PrgRamSize(0),
+	MapperNumber(0),
+	Submapper(0),
+	NametableMirroring(Mirroring::HORIZONTAL),
+	Battery(false),
+	Trainer(false),
+	Nes2(false) {
+	std::ifstream fs(path.c_str(), std::ios::binary);
+
+	uint8_t header[16];
+	if(!fs.read((char*)header, sizeof(header)) || memcmp(header, "NES\x1A", 4) != 0)
+		throw std::runtime_error("Not an ines file");
 
-	// For now just set up the basic mapping scheme. 0x8000->0xBFFF maps to
-	// rom, and 0xC000->Whatever maps back around.
+	uint8_t flags6 = header[6];
+	uint8_t flags7 = header[7];
+	if(flags6 & 0x08)
+		this->NametableMirroring = Mirroring::FOUR_SCREEN;
+	else if(flags6 & 0x01)
+		this->NametableMirroring = Mirroring::VERTICAL;
+	this->Battery = flags6 & 0x02;
+	this->Trainer = flags6 & 0x04;
+	this->MapperNumber = (flags6 >> 4) | (flags7 & 0xF0);
+
+	// NES 2.0 marks itself with 0b10 in bits 2 and 3 of flags 7
+	this->Nes2 = (flags7 & 0x0C) == 0x08;
+	if(this->Nes2) {
+		this->MapperNumber |= (header[8] & 0x0F) << 8;
+		this->Submapper = header[8] >> 4;
+		this->PrgRomSize = romSize(header[4], header[9] & 0x0F, 0x4000);
+		this->ChrRomSize = romSize(header[5], header[9] >> 4, 0x2000);
+		this->PrgRamSize = ramSize(header[10] & 0x0F) + ramSize(header[10] >> 4);
+	} else {
+		this->PrgRomSize = header[4] * 0x4000;
+		this->ChrRomSize = header[5] * 0x2000;
+		// 0 means 8K, dumps from before the field existed all have it
+		this->PrgRamSize = (header[8] != 0 ? header[8] : 1) * 0x2000;
+		// @HACK: Old dumping tools signed their work in the padding, which
+		// leaves garbage in the upper half of the mapper number too
+		if(header[12] != 0 || header[13] != 0 || header[14] != 0 || header[15] != 0)
+			this->MapperNumber &= 0x0F;
+	}
+	if(this->PrgRomSize == 0)
+		throw std::runtime_error("The ines file has no PRG ROM");
+
+	fmt::print(
+		"It's an {} file: mapper {}, {}K PRG ROM, {}K CHR ROM, {}K PRG RAM\n",
+		this->Nes2 ? "NES 2.0" : "ines",
+		this->MapperNumber,
+		this->PrgRomSize / 1024,
+		this->ChrRomSize / 1024,
+		this->PrgRamSize / 1024
+	);
+
+	// The 2K of internal RAM repeats up to 0x1FFF and the 8 PPU registers
+	// up to 0x3FFF
 	mapper.setBank(0x00, std::make_shared<RamMemoryBank>(0x800));
-	mapper.setBank(0x80, std::make_shared<ReadingMemoryBank>(fs, 16384 * this->PrgRomSize));
-	mapper.setBank(0xC0, std::make_shared<RemappingMemoryBank>(mapper, 0x8000, 0x4000));
+	mapper.mirror(0x08, 0x18, 0x00, 0x08);
+	mapper.setBank(0x20, std::make_shared<IoMemoryBank>(8, 0x2000));
+
+	// @COMPLETENESS: Battery backed RAM isn't saved anywhere, and boards
+	// with less than 8K don't mirror it
+	if(this->PrgRamSize != 0)
+		mapper.setBank(0x60, std::make_shared<RamMemoryBank>(0x2000));
+
+	// The 512 byte trainer sits between the header and the PRG ROM. It is
+	// meant to be loaded at 0x7000, which nothing we run needs.
+	size_t prgOffset = sizeof(header) + (this->Trainer ? 512 : 0);
+	auto prg = std::make_shared<ReadingMemoryBank>(path, prgOffset, this->PrgRomSize);
+	board = createBoard(this->MapperNumber, mapper, prg, this->PrgRomSize);
+	board->reset();
 }
 
 MemoryMapper& INes::getMapper() {
@@ -5,6 +5,7 @@
 #include <memory>
 #include <asmjit/asmjit.h>
 
+#include "mapper/board.h"
 #include "mapper/memorymapper.h"
 
 class ParserPointer {
@@ -18,14 +19,30 @@ class ParserPointer {
 		void jump(size_t newPointer);
 };
 
+enum class Mirroring {
+	HORIZONTAL,
+	VERTICAL,
+	FOUR_SCREEN,
+};
+
 class INes {
 	private:
 		MemoryMapper mapper;
-		std::shared_ptr<char> memory;
+		// Destroyed before the mapper it is attached to
+		std::unique_ptr<Board> board;
 	public:
-		uint16_t PrgRomSize;
-		uint8_t ChrRomSize;
-		uint8_t PrgRamSize;
+		// Sizes in bytes
+		size_t PrgRomSize;
+		size_t ChrRomSize;
+		// Work RAM at 0x6000, battery backed or not
+		size_t PrgRamSize;
+		uint16_t MapperNumber;
+		uint8_t Submapper;
+		Mirroring NametableMirroring;
+		bool Battery;
+		bool Trainer;
+		// Whether the header is in the NES 2.0 format
+		bool Nes2;
 
 		INes(std::string path);
 
@@ -1,43 +1,44 @@
 #include "instruction.h"
 //@CLEANUP only include memorymapper when split
 #include "ines.h"
+#include "registers.h"
 #include <fmt/format.h>
 
-#define REG_SP asmjit::x86::r10b
-#define REG_S  asmjit::x86::r11b
-#define REG_A  asmjit::x86::r13b
-#define REG_X  asmjit::x86::r14b
-#define REG_Y  asmjit::x86::r15b
-
-#define REG_TMP asmjit::x86::rax
-
-#define S_CARRY         0
-#define S_ZERO          1
-#define S_INTER_DISABLE 2
-#define S_DECIMAL       3
-#define S_INTERRUPT     4
-#define S_ALWAYS        5
-#define S_OVERFLOW      6
-#define S_NEGATIVE      7
+static void setNZ(CpuContext& r, uint8_t value) {
+	r.s &= ~((1 << S_ZERO) | (1 << S_NEGATIVE));
+	if(value == 0)
+		r.s |= 1 << S_ZERO;
+	if(value & 0x80)
+		r.s |= 1 << S_NEGATIVE;
+}
 
-extern "C" uint64_t jit_and_jump();
+static void setFlag(CpuContext& r, int flag, bool value) {
+	if(value)
+		r.s |= 1 << flag;
+	else
+		r.s &= ~(1 << flag);
+}
 
-static void dump(uint8_t A, uint8_t X, uint8_t Y, uint8_t status) {
-	fmt::print("A: 0x{:X}, X: 0x{:X}, Y: 0x{:X}, Status: 0b{:B}\n", A, X, Y, status);
+static bool getFlag(CpuContext& r, int flag) {
+	return (r.s >> flag) & 1;
 }
 
-static void emitDump(asmjit::X86Assembler& a) {
-	a.push(asmjit::x86::r10);
-	a.push(asmjit::x86::r11);
+static void push(CpuContext& r, MemoryMapper& m, uint8_t value) {
+	m.setValue(0x0100 + r.sp, value);
+	r.sp--;
+}
 
-	a.mov(asmjit::x86::dil, REG_A);
-	a.mov(asmjit::x86::sil, REG_X);
-	a.mov(asmjit::x86::dl, REG_Y);
-	a.mov(asmjit::x86::cl, REG_S);
-	a.call((uint64_t)&dump);
+static uint8_t pop(CpuContext& r, MemoryMapper& m) {
+	r.sp++;
+	return m.getValue(0x0100 + r.sp);
+}
 
-	a.pop(asmjit::x86::r11);
-	a.pop(asmjit::x86::r10);
+void enterInterrupt(CpuContext& r, MemoryMapper& m, uint16_t& pc, uint16_t ret, uint16_t vector, bool brk) {
+	push(r, m, ret >> 8);
+	push(r, m, ret & 0xFF);
+	push(r, m, r.s | (brk ? 1 << S_INTERRUPT : 0) | (1 << S_ALWAYS));
+	setFlag(r, S_INTER_DISABLE, true);
+	pc = m.getValue(vector) | (m.getValue(vector + 1) << 8);
 }
 
 std::string Instr::format() {
@@ -48,13 +49,47 @@ bool Instr::stop_jit() {
 	return !this->cont;
 }
 
+bool Instr::follow(uint16_t& location) {
+	return false;
+}
+
+bool JMPAbsInstr::follow(uint16_t& location) {
+	location = this->m_target;
+	return true;
+}
+
+bool JSRAbsInstr::follow(uint16_t& location) {
+	location = this->target;
+	return true;
+}
+
+// Conditional branches are traced along the not taken path, the taken one
+// becomes a side exit
+bool BranchInstr::follow(uint16_t& location) {
+	location = this->next;
+	return true;
+}
+
+bool Instr::compilable() {
+	return true;
+}
+
+bool ADCImmInstr::compilable() {
+	return false;
+}
+
+bool STAAbsXInstr::compilable() {
+	return false;
+}
+
 std::unique_ptr<Instr> LDAImmInstr::create(ParserPointer& pp) {
 	uint8_t value = pp.next();
 	return std::make_unique<LDAImmInstr>(value);
 }
 
 std::unique_ptr<Instr> LDAAbsXInstr::create(ParserPointer& pp) {
-	return std::make_unique<LDAAbsXInstr>();
+	uint16_t base = pp.next() | (pp.next() << 8);
+	return std::make_unique<LDAAbsXInstr>(base);
 }
 
 std::unique_ptr<Instr> LDXImmInstr::create(ParserPointer& pp) {
@@ -74,7 +109,8 @@ std::unique_ptr<Instr> JSRAbsInstr::create(ParserPointer& pp) {
 }
 
 std::unique_ptr<Instr> STAAbsXInstr::create(ParserPointer& pp) {
-	return std::make_unique<STAAbsXInstr>();
+	uint16_t base = pp.next() | (pp.next() << 8);
+	return std::make_unique<STAAbsXInstr>(base);
 }
 
 std::unique_ptr<Instr> STXZeroPInstr::create(ParserPointer& pp) {
@@ -84,9 +120,10 @@ std::unique_ptr<Instr> STXZeroPInstr::create(ParserPointer& pp) {
 
 template<class T>
 std::unique_ptr<Instr> BranchInstr::create(ParserPointer& pp) {
-	uint8_t operand = pp.next();
+	// The offset is signed and relative to the next instruction
+	int8_t operand = pp.next();
 	uint16_t next = pp.getLocation();
-	return std::make_unique<T>(operand, next);
+	return std::make_unique<T>(next + operand, next);
 }
 
 template<class T>
@@ -100,7 +137,7 @@ std::unique_ptr<Instr> NoArg::create(ParserPointer& pp) {
 	return std::make_unique<T>();
 }
 
-bool Instr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
+void Instr::lower(IrBlock& ir) {
 	throw std::logic_error(
 		fmt::format(
 			"Instruction {} in addressing mode {} is not yet supported",
@@ -110,345 +147,284 @@ bool Instr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
 	);
 }
 
-bool JMPAbsInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.mov(asmjit::x86::di, this->m_target);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void Instr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	throw std::logic_error(
+		fmt::format(
+			"Instruction {} in addressing mode {} can't be interpreted yet",
+			this->m_name,
+			this->m_addrMode
+		)
+	);
 }
 
-template<class T>
-void virtual_push(asmjit::X86Assembler& a, MemoryMapper& m, T value) {
-	a.mov(REG_TMP, 0x0100);
-	// @CLEANUP TMP is rax, but we can't or with a larger register
-	a.add(asmjit::x86::al, REG_SP);
-	m.emitDynamicStore(a, REG_TMP, value);
-	a.dec(REG_SP);
+void JMPAbsInstr::lower(IrBlock& ir) {
+	ir.continueAt(this->m_target);
 }
 
-template<class T>
-void virtual_pop(asmjit::X86Assembler& a, MemoryMapper& m, T dst) {
-	a.inc(REG_SP);
-	a.mov(REG_TMP, 0x0100);
-	// @CLEANUP TMP is rax, but we can't or with a larger register
-	a.add(asmjit::x86::al, REG_SP);
-	m.emitDynamicLoad(a, REG_TMP, dst);
-}
-
-bool JSRAbsInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	// Push the virtual PC to the stack
-	// @COMPLETENESS: This order is likely wrong!
-	virtual_push(a, m, static_cast<uint8_t>(next & 0xFF));
-	virtual_push(a, m, static_cast<uint8_t>(next >> 8));
-
-	a.mov(asmjit::x86::di, this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void JSRAbsInstr::lower(IrBlock& ir) {
+	// Push the address of the last byte of the JSR, high byte first
+	uint16_t ret = next - 1;
+	ir.pushImm(ret >> 8);
+	ir.pushImm(ret & 0xFF);
+	ir.continueAt(this->target);
 }
 
-bool RTS::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	// Use rbx because that's safe during a call
-	virtual_pop(a, m, asmjit::x86::bl);
-	a.shl(asmjit::x86::bx, 8);
-	virtual_pop(a, m, asmjit::x86::dl);
-	a.or_(asmjit::x86::bx, asmjit::x86::dx);
-	a.mov(asmjit::x86::rdi, asmjit::x86::rbx);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void RTS::lower(IrBlock& ir) {
+	ir.pop(IR_T0);
+	ir.pop(IR_T1);
+	// JSR pushed the address of its own last byte
+	ir.jumpInd(IR_T0, IR_T1, 1);
 }
 
-bool SEI::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.bts(REG_S, S_INTER_DISABLE);
-	return true;
+void SEI::lower(IrBlock& ir) {
+	ir.setFlag(S_INTER_DISABLE, true);
 }
 
-bool SED::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.bts(REG_S, S_DECIMAL);
-	return true;
+void SED::lower(IrBlock& ir) {
+	ir.setFlag(S_DECIMAL, true);
 }
 
-bool CLD::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.btr(REG_S, S_DECIMAL);
-	return true;
+void CLD::lower(IrBlock& ir) {
+	ir.setFlag(S_DECIMAL, false);
 }
 
-bool PHP::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	virtual_push(a, m, REG_S);
-	return true;
+void PHP::lower(IrBlock& ir) {
+	ir.pushFlags();
 }
 
-bool PLA::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	virtual_pop(a, m, REG_A);
-	return true;
+void PLA::lower(IrBlock& ir) {
+	// Popping doesn't set any flags, the move does
+	ir.pop(IR_T0);
+	ir.mov(IR_A, IR_T0);
 }
 
-bool PLP::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	virtual_pop(a, m, REG_S);
-	return true;
+void PLP::lower(IrBlock& ir) {
+	ir.popFlags();
 }
 
-bool PHA::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	virtual_push(a, m, REG_A);
-	return true;
+void PHA::lower(IrBlock& ir) {
+	ir.push(IR_A);
 }
 
-bool STXZeroPInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	m.emitStore(a, operand, REG_X);
-	return true;
+void STXZeroPInstr::lower(IrBlock& ir) {
+	ir.store(operand, IR_X);
 }
 
-bool ANDImm::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.and_(REG_A, this->operand);
-	return true;
+void ANDImm::lower(IrBlock& ir) {
+	ir.aluImm(IrOp::AND, IR_A, this->operand);
 }
 
-bool CMPImm::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.cmp(REG_A, this->operand);
+void CMPImm::lower(IrBlock& ir) {
+	ir.aluImm(IrOp::CMP, IR_A, this->operand);
+}
 
-	{
-		a.pushfd();
-		a.btr(REG_S, S_CARRY);
-		a.popfd();
-		auto End = a.newLabel();
-		a.jnc(End);
-		a.pushfd();
-		a.bts(REG_S, S_CARRY);
-		a.popfd();
-		a.bind(End);
-	}
+void LDAImmInstr::lower(IrBlock& ir) {
+	ir.loadImm(IR_A, this->value);
+}
 
-	{
-		a.pushfd();
-		a.btr(REG_S, S_ZERO);
-		a.popfd();
+void LDAAbsXInstr::lower(IrBlock& ir) {
+	ir.loadIdx(IR_A, this->base, IR_X);
+}
 
+void LDXImmInstr::lower(IrBlock& ir) {
+	ir.loadImm(IR_X, this->m_value);
+}
 
-		auto End = a.newLabel();
-		a.jne(End);
-		a.pushfd();
-		a.bts(REG_S, S_ZERO);
-		a.popfd();
-		a.bind(End);
-	}
+void NOP::lower(IrBlock& ir) {
+}
 
-	{
-		a.pushfd();
-		a.btr(REG_S, S_NEGATIVE);
-		a.popfd();
+void SEC::lower(IrBlock& ir) {
+	ir.setFlag(S_CARRY, true);
+}
 
+void CLC::lower(IrBlock& ir) {
+	ir.setFlag(S_CARRY, false);
+}
 
-		auto End = a.newLabel();
-		a.jns(End);
-		a.pushfd();
-		a.bts(REG_S, S_NEGATIVE);
-		a.popfd();
-		a.bind(End);
-	}
-	return true;
+void BCSRelInstr::lower(IrBlock& ir) {
+	ir.branch(S_CARRY, true, this->target);
+	ir.continueAt(this->next);
 }
 
-bool LDAImmInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.mov(REG_A, this->value);
+void BCCRelInstr::lower(IrBlock& ir) {
+	ir.branch(S_CARRY, false, this->target);
+	ir.continueAt(this->next);
+}
 
-	// Immediate mode knows the value at compile time, so just emit the right
-	// thing
-	if(this->value == 0)
-		a.bts(REG_S, S_ZERO);
-	else
-		a.btr(REG_S, S_ZERO);
+void BVSRelInstr::lower(IrBlock& ir) {
+	ir.branch(S_OVERFLOW, true, this->target);
+	ir.continueAt(this->next);
+}
 
-	if((this->value & 0x80) == 0)
-		a.btr(REG_S, S_NEGATIVE);
-	else
-		a.bts(REG_S, S_NEGATIVE);
-	return true;
+void BVCRelInstr::lower(IrBlock& ir) {
+	ir.branch(S_OVERFLOW, false, this->target);
+	ir.continueAt(this->next);
 }
 
-bool LDAAbsXInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto temp = asmjit::x86::rax;
-	a.mov(temp, this->base);
-	a.add(temp, REG_X);
-	auto tmpPtr = asmjit::x86::byte_ptr(temp);
+void BEQRelInstr::lower(IrBlock& ir) {
+	ir.branch(S_ZERO, true, this->target);
+	ir.continueAt(this->next);
+}
 
-	{
-		auto NotZero = a.newLabel();
-		auto Exit = a.newLabel();
-		a.cmp(tmpPtr, 0);
-		a.jne(NotZero);
-		// Value was 0
-		a.bts(REG_S, S_ZERO);
-		a.jmp(Exit);
+void BNERelInstr::lower(IrBlock& ir) {
+	ir.branch(S_ZERO, false, this->target);
+	ir.continueAt(this->next);
+}
 
-		// Value was not 0
-		a.bind(NotZero);
-		a.btr(REG_S, S_ZERO);
-		//No jmp required, just fall though
+void BPLRelInstr::lower(IrBlock& ir) {
+	ir.branch(S_NEGATIVE, false, this->target);
+	ir.continueAt(this->next);
+}
 
-		a.bind(Exit);
-	}
+void STAZeroP::lower(IrBlock& ir) {
+	ir.store(operand, IR_A);
+}
 
-	a.mov(REG_A, tmpPtr);
-	return true;
+void BITZeroP::lower(IrBlock& ir) {
+	ir.load(IR_T0, operand, false);
+	ir.flagsVN(IR_T0);
+	ir.alu(IrOp::TEST, IR_T0, IR_A);
 }
 
-bool LDXImmInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.mov(REG_X, this->m_value);
-	// Immediate mode knows the value at compile time, so just emit the right
-	// thing
-	if(this->m_value == 0)
-		a.bts(REG_S, S_ZERO);
-	else
-		a.btr(REG_S, S_ZERO);
-	return true;
+void JMPAbsInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	pc = this->m_target;
 }
 
-bool NOP::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.nop();
-	return true;
+void JSRAbsInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	uint16_t ret = next - 1;
+	push(r, m, ret >> 8);
+	push(r, m, ret & 0xFF);
+	pc = this->target;
 }
 
-bool SEC::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.bts(REG_S, S_CARRY);
-	return true;
+void RTS::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	uint16_t ret = pop(r, m);
+	ret |= pop(r, m) << 8;
+	pc = ret + 1;
 }
 
-bool CLC::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	a.btr(REG_S, S_CARRY);
-	return true;
+void SEI::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	setFlag(r, S_INTER_DISABLE, true);
 }
 
-bool BCSRelInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto NotSet = a.newLabel();
+void SED::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	setFlag(r, S_DECIMAL, true);
+}
 
-	a.bt(REG_S, S_CARRY);
-	a.jnc(NotSet);
-	a.mov(asmjit::x86::di, this->next + this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	a.bind(NotSet);
-	a.mov(asmjit::x86::di, this->next);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void CLD::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	setFlag(r, S_DECIMAL, false);
 }
 
-bool BCCRelInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto Set = a.newLabel();
+void SEC::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	setFlag(r, S_CARRY, true);
+}
 
-	a.bt(REG_S, S_CARRY);
-	a.jc(Set);
-	a.mov(asmjit::x86::di, this->next + this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	a.bind(Set);
-	a.mov(asmjit::x86::di, this->next);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void CLC::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	setFlag(r, S_CARRY, false);
 }
 
-bool BVSRelInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto NotSet = a.newLabel();
+void PHP::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	push(r, m, r.s | (1 << S_INTERRUPT));
+}
 
-	a.bt(REG_S, S_OVERFLOW);
-	a.jnc(NotSet);
-	a.mov(asmjit::x86::di, this->next + this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	a.bind(NotSet);
-	a.mov(asmjit::x86::di, this->next);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void PLA::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	r.a = pop(r, m);
+	setNZ(r, r.a);
 }
 
-bool BVCRelInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto Set = a.newLabel();
+void PLP::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	r.s = pop(r, m);
+	setFlag(r, S_INTERRUPT, false);
+	setFlag(r, S_ALWAYS, true);
+}
 
-	a.bt(REG_S, S_OVERFLOW);
-	a.jc(Set);
-	a.mov(asmjit::x86::di, this->next + this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	a.bind(Set);
-	a.mov(asmjit::x86::di, this->next);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void PHA::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	push(r, m, r.a);
 }
 
-bool BEQRelInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto NotSet = a.newLabel();
+void STXZeroPInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	m.setValue(operand, r.x);
+}
 
-	a.bt(REG_S, S_ZERO);
-	a.jnc(NotSet);
-	a.mov(asmjit::x86::di, this->next + this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	a.bind(NotSet);
-	a.mov(asmjit::x86::di, this->next);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void STAZeroP::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	m.setValue(operand, r.a);
 }
 
-bool BNERelInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto Set = a.newLabel();
+void STAAbsXInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	m.setValue((uint16_t)(base + r.x), r.a);
+}
 
-	a.bt(REG_S, S_ZERO);
-	a.jc(Set);
-	a.mov(asmjit::x86::di, this->next + this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	a.bind(Set);
-	a.mov(asmjit::x86::di, this->next);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void ANDImm::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	r.a &= operand;
+	setNZ(r, r.a);
 }
 
-bool BPLRelInstr::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	auto Set = a.newLabel();
+void CMPImm::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	setFlag(r, S_CARRY, r.a >= operand);
+	setNZ(r, r.a - operand);
+}
 
-	a.bt(REG_S, S_NEGATIVE);
-	a.jc(Set);
-	a.mov(asmjit::x86::di, this->next + this->target);
-	a.jmp((uint64_t)&jit_and_jump);
-	a.bind(Set);
-	a.mov(asmjit::x86::di, this->next);
-	a.jmp((uint64_t)&jit_and_jump);
-	return false;
+void BITZeroP::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	uint8_t value = m.getValue(operand);
+	setFlag(r, S_ZERO, (value & r.a) == 0);
+	setFlag(r, S_OVERFLOW, value & (1 << 6));
+	setFlag(r, S_NEGATIVE, value & (1 << 7));
 }
 
-bool STAZeroP::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	m.emitStore(a, operand, REG_A);
-	return true;
+void LDAImmInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	r.a = value;
+	setNZ(r, r.a);
 }
 
-bool BITZeroP::exp(asmjit::X86Assembler& a, MemoryMapper& m) {
-	m.emitLoad(a, operand, asmjit::x86::al);
-	// @COMPLETENESS: We should check and set the S_ flags here before the and
-	a.push(asmjit::x86::rax);
-
-	a.and_(asmjit::x86::al, REG_A);
-	auto Zero = a.newLabel();
-	auto Exit = a.newLabel();
-	a.jz(Zero);
-
-	//Not zero
-	a.btr(REG_S, S_ZERO);
-	a.jmp(Exit);
-	a.bind(Zero);
-	a.bts(REG_S, S_ZERO);
-	a.bind(Exit);
-
-	a.pop(asmjit::x86::rax);
-
-	{
-		a.btr(REG_S, S_OVERFLOW);
-		a.bt(asmjit::x86::al, 6);
-		auto End = a.newLabel();
-		a.jnc(End);
-		a.bts(REG_S, S_OVERFLOW);
-		a.bind(End);
-	}
+void LDAAbsXInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	uint16_t addr = base + r.x;
+	if((addr & 0xFF00) != (base & 0xFF00))
+		r.budget--;
+	r.a = m.getValue(addr);
+	setNZ(r, r.a);
+}
 
-	{
-		a.btr(REG_S, S_NEGATIVE);
-		a.bt(asmjit::x86::al, 7);
-		auto End = a.newLabel();
-		a.jnc(End);
-		a.bts(REG_S, S_NEGATIVE);
-		a.bind(End);
-	}
-	return true;
+void LDXImmInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	r.x = m_value;
+	setNZ(r, r.x);
+}
+
+void NOP::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+}
+
+void BCSRelInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	if(getFlag(r, S_CARRY))
+		pc = target;
+}
+
+void BCCRelInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	if(!getFlag(r, S_CARRY))
+		pc = target;
+}
+
+void BVSRelInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	if(getFlag(r, S_OVERFLOW))
+		pc = target;
+}
+
+void BVCRelInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	if(!getFlag(r, S_OVERFLOW))
+		pc = target;
+}
+
+void BEQRelInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	if(getFlag(r, S_ZERO))
+		pc = target;
+}
+
+void BNERelInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	if(!getFlag(r, S_ZERO))
+		pc = target;
+}
+
+void BPLRelInstr::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	if(!getFlag(r, S_NEGATIVE))
+		pc = target;
 }
 
 std::string JMPAbsInstr::format() {
@@ -471,6 +447,10 @@ std::string LDAAbsXInstr::format() {
 	return fmt::format("{} {:X},X", m_name, base);
 }
 
+std::string STAAbsXInstr::format() {
+	return fmt::format("{} {:X},X", m_name, base);
+}
+
 std::string STXZeroPInstr::format() {
 	return fmt::format("{} ${:X}", m_name, operand);
 }
@@ -510,3 +490,341 @@ std::string SingleByte::format() {
 std::string NoArg::format() {
 	return fmt::format("{}", m_name);
 }
+
+const char* Fallback::names[] = {
+	"XXX", "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE",
+	"BPL", "BRK", "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX",
+	"CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR",
+	"LDA", "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP",
+	"ROL", "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX",
+	"STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA"
+};
+
+const Fallback::Entry Fallback::table[256] = {
+	{ Fallback::BRK, IMPLIED }     , { Fallback::ORA, X_INDIRECT }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::ORA, ZEROPAGE }    , { Fallback::ASL, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::PHP, IMPLIED }     , { Fallback::ORA, IMMEDIATE }   , { Fallback::ASL, ACCUMULATOR } , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::ORA, ABSOLUTE }    , { Fallback::ASL, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // 00h
+	{ Fallback::BPL, RELATIVE }    , { Fallback::ORA, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::ORA, ZEROPAGE_X }  , { Fallback::ASL, ZEROPAGE_X }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::CLC, IMPLIED }     , { Fallback::ORA, ABSOLUTE_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::ORA, ABSOLUTE_X }  , { Fallback::ASL, ABSOLUTE_X }  , { Fallback::XXX, IMPLIED }     , // 10h
+	{ Fallback::JSR, ABSOLUTE }    , { Fallback::AND, X_INDIRECT }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::BIT, ZEROPAGE }    , { Fallback::AND, ZEROPAGE }    , { Fallback::ROL, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::PLP, IMPLIED }     , { Fallback::AND, IMMEDIATE }   , { Fallback::ROL, ACCUMULATOR } , { Fallback::XXX, IMPLIED }     , { Fallback::BIT, ABSOLUTE }    , { Fallback::AND, ABSOLUTE }    , { Fallback::ROL, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // 20h
+	{ Fallback::BMI, RELATIVE }    , { Fallback::AND, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::AND, ZEROPAGE_X }  , { Fallback::ROL, ZEROPAGE_X }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::SEC, IMPLIED }     , { Fallback::AND, ABSOLUTE_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::AND, ABSOLUTE_X }  , { Fallback::ROL, ABSOLUTE_X }  , { Fallback::XXX, IMPLIED }     , // 30h
+	{ Fallback::RTI, IMPLIED }     , { Fallback::EOR, X_INDIRECT }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::EOR, ZEROPAGE }    , { Fallback::LSR, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::PHA, IMPLIED }     , { Fallback::EOR, IMMEDIATE }   , { Fallback::LSR, ACCUMULATOR } , { Fallback::XXX, IMPLIED }     , { Fallback::JMP, ABSOLUTE }    , { Fallback::EOR, ABSOLUTE }    , { Fallback::LSR, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // 40h
+	{ Fallback::BVC, RELATIVE }    , { Fallback::EOR, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::EOR, ZEROPAGE_X }  , { Fallback::LSR, ZEROPAGE_X }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::CLI, IMPLIED }     , { Fallback::EOR, ABSOLUTE_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::EOR, ABSOLUTE_X }  , { Fallback::LSR, ABSOLUTE_X }  , { Fallback::XXX, IMPLIED }     , // 50h
+	{ Fallback::RTS, IMPLIED }     , { Fallback::ADC, X_INDIRECT }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::ADC, ZEROPAGE }    , { Fallback::ROR, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::PLA, IMPLIED }     , { Fallback::ADC, IMMEDIATE }   , { Fallback::ROR, ACCUMULATOR } , { Fallback::XXX, IMPLIED }     , { Fallback::JMP, INDIRECT }    , { Fallback::ADC, ABSOLUTE }    , { Fallback::ROR, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // 60h
+	{ Fallback::BVS, RELATIVE }    , { Fallback::ADC, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::ADC, ZEROPAGE_X }  , { Fallback::ROR, ZEROPAGE_X }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::SEI, IMPLIED }     , { Fallback::ADC, ABSOLUTE_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::ADC, ABSOLUTE_X }  , { Fallback::ROR, ABSOLUTE_X }  , { Fallback::XXX, IMPLIED }     , // 70h
+	{ Fallback::XXX, IMPLIED }     , { Fallback::STA, X_INDIRECT }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::STY, ZEROPAGE }    , { Fallback::STA, ZEROPAGE }    , { Fallback::STX, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::DEY, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::TXA, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::STY, ABSOLUTE }    , { Fallback::STA, ABSOLUTE }    , { Fallback::STX, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // 80h
+	{ Fallback::BCC, RELATIVE }    , { Fallback::STA, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::STY, ZEROPAGE_X }  , { Fallback::STA, ZEROPAGE_X }  , { Fallback::STX, ZEROPAGE_Y }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::TYA, IMPLIED }     , { Fallback::STA, ABSOLUTE_Y }  , { Fallback::TXS, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::STA, ABSOLUTE_X }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , // 90h
+	{ Fallback::LDY, IMMEDIATE }   , { Fallback::LDA, X_INDIRECT }  , { Fallback::LDX, IMMEDIATE }   , { Fallback::XXX, IMPLIED }     , { Fallback::LDY, ZEROPAGE }    , { Fallback::LDA, ZEROPAGE }    , { Fallback::LDX, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::TAY, IMPLIED }     , { Fallback::LDA, IMMEDIATE }   , { Fallback::TAX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::LDY, ABSOLUTE }    , { Fallback::LDA, ABSOLUTE }    , { Fallback::LDX, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // A0h
+	{ Fallback::BCS, RELATIVE }    , { Fallback::LDA, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::LDY, ZEROPAGE_X }  , { Fallback::LDA, ZEROPAGE_X }  , { Fallback::LDX, ZEROPAGE_Y }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::CLV, IMPLIED }     , { Fallback::LDA, ABSOLUTE_Y }  , { Fallback::TSX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::LDY, ABSOLUTE_X }  , { Fallback::LDA, ABSOLUTE_X }  , { Fallback::LDX, ABSOLUTE_Y }  , { Fallback::XXX, IMPLIED }     , // B0h
+	{ Fallback::CPY, IMMEDIATE }   , { Fallback::CMP, X_INDIRECT }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::CPY, ZEROPAGE }    , { Fallback::CMP, ZEROPAGE }    , { Fallback::DEC, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::INY, IMPLIED }     , { Fallback::CMP, IMMEDIATE }   , { Fallback::DEX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::CPY, ABSOLUTE }    , { Fallback::CMP, ABSOLUTE }    , { Fallback::DEC, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // C0h
+	{ Fallback::BNE, RELATIVE }    , { Fallback::CMP, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::CMP, ZEROPAGE_X }  , { Fallback::DEC, ZEROPAGE_X }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::CLD, IMPLIED }     , { Fallback::CMP, ABSOLUTE_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::CMP, ABSOLUTE_X }  , { Fallback::DEC, ABSOLUTE_X }  , { Fallback::XXX, IMPLIED }     , // D0h
+	{ Fallback::CPX, IMMEDIATE }   , { Fallback::SBC, X_INDIRECT }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::CPX, ZEROPAGE }    , { Fallback::SBC, ZEROPAGE }    , { Fallback::INC, ZEROPAGE }    , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::INX, IMPLIED }     , { Fallback::SBC, IMMEDIATE }   , { Fallback::NOP, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::CPX, ABSOLUTE }    , { Fallback::SBC, ABSOLUTE }    , { Fallback::INC, ABSOLUTE }    , { Fallback::XXX, IMPLIED }     , // E0h
+	{ Fallback::BEQ, RELATIVE }    , { Fallback::SBC, INDIRECT_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::SBC, ZEROPAGE_X }  , { Fallback::INC, ZEROPAGE_X }  , { Fallback::XXX, IMPLIED }     ,
+	{ Fallback::SED, IMPLIED }     , { Fallback::SBC, ABSOLUTE_Y }  , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::XXX, IMPLIED }     , { Fallback::SBC, ABSOLUTE_X }  , { Fallback::INC, ABSOLUTE_X }  , { Fallback::XXX, IMPLIED }     , // F0h
+};
+
+// Base cycles of every opcode. Reads that index into the next page and taken
+// branches cost extra, whoever runs the instruction adds that.
+const uint8_t opcodeCycles[256] = {
+//  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+	7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6, // 00h
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 10h
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6, // 20h
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 30h
+	6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6, // 40h
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 50h
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6, // 60h
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // 70h
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4, // 80h
+	2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5, // 90h
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4, // A0h
+	2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4, // B0h
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, // C0h
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // D0h
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, // E0h
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, // F0h
+};
+
+std::unique_ptr<Instr> Fallback::create(uint8_t opcode, ParserPointer& pp) {
+	const Entry& entry = table[opcode];
+	if(entry.op == XXX)
+		return nullptr;
+
+	uint16_t operand = 0;
+	switch(entry.mode) {
+		case IMPLIED:
+		case ACCUMULATOR:
+			break;
+		case ABSOLUTE:
+		case ABSOLUTE_X:
+		case ABSOLUTE_Y:
+		case INDIRECT:
+			operand = pp.next() | (pp.next() << 8);
+			break;
+		case RELATIVE: {
+			// Store the absolute target like BranchInstr does
+			int8_t offset = pp.next();
+			operand = pp.getLocation() + offset;
+			break;
+		}
+		default:
+			operand = pp.next();
+			break;
+	}
+
+	bool cont;
+	switch(entry.op) {
+		case BRK: case JMP: case JSR: case RTI: case RTS:
+		case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS:
+			cont = false;
+			break;
+		default:
+			cont = true;
+			break;
+	}
+	return std::make_unique<Fallback>(entry.op, entry.mode, operand, cont);
+}
+
+bool Fallback::compilable() {
+	return false;
+}
+
+uint16_t Fallback::address(CpuContext& r, MemoryMapper& m) {
+	switch(m_addrMode) {
+		case ZEROPAGE:
+		case ABSOLUTE:
+			return operand;
+		case ZEROPAGE_X:
+			return (uint8_t)(operand + r.x);
+		case ZEROPAGE_Y:
+			return (uint8_t)(operand + r.y);
+		case ABSOLUTE_X:
+			return operand + r.x;
+		case ABSOLUTE_Y:
+			return operand + r.y;
+		case X_INDIRECT: {
+			uint8_t ptr = operand + r.x;
+			return m.getValue(ptr) | (m.getValue((uint8_t)(ptr + 1)) << 8);
+		}
+		case INDIRECT_Y: {
+			uint16_t base = m.getValue(operand) | (m.getValue((uint8_t)(operand + 1)) << 8);
+			return base + r.y;
+		}
+		case INDIRECT: {
+			// The high byte is never fetched from the next page
+			uint16_t high = (operand & 0xFF00) | ((operand + 1) & 0x00FF);
+			return m.getValue(operand) | (m.getValue(high) << 8);
+		}
+		default:
+			throw std::logic_error(
+				fmt::format("Addressing mode {} has no address", this->m_addrMode)
+			);
+	}
+}
+
+uint8_t Fallback::read(CpuContext& r, MemoryMapper& m) {
+	if(m_addrMode == IMMEDIATE)
+		return operand;
+	if(m_addrMode == ACCUMULATOR)
+		return r.a;
+
+	uint16_t addr = address(r, m);
+	// Indexing into the next page costs a cycle on reads. Writes always pay
+	// it, opcodeCycles has that already.
+	uint8_t index = m_addrMode == ABSOLUTE_X ? r.x : r.y;
+	bool indexed = m_addrMode == ABSOLUTE_X || m_addrMode == ABSOLUTE_Y || m_addrMode == INDIRECT_Y;
+	if(indexed && (addr & 0xFF) < index)
+		r.budget--;
+	return m.getValue(addr);
+}
+
+static void compare(CpuContext& r, uint8_t reg, uint8_t value) {
+	setFlag(r, S_CARRY, reg >= value);
+	setNZ(r, reg - value);
+}
+
+static void addWithCarry(CpuContext& r, uint8_t value) {
+	uint16_t sum = r.a + value + getFlag(r, S_CARRY);
+	setFlag(r, S_CARRY, sum > 0xFF);
+	setFlag(r, S_OVERFLOW, ~(r.a ^ value) & (r.a ^ sum) & 0x80);
+	r.a = sum;
+	setNZ(r, r.a);
+}
+
+void Fallback::run(CpuContext& r, MemoryMapper& m, uint16_t& pc) {
+	switch(op) {
+		case ADC:
+			addWithCarry(r, read(r, m));
+			break;
+		case SBC:
+			// The NES has no decimal mode, so this is just ADC of the complement
+			addWithCarry(r, read(r, m) ^ 0xFF);
+			break;
+		case AND:
+			r.a &= read(r, m);
+			setNZ(r, r.a);
+			break;
+		case ORA:
+			r.a |= read(r, m);
+			setNZ(r, r.a);
+			break;
+		case EOR:
+			r.a ^= read(r, m);
+			setNZ(r, r.a);
+			break;
+		case ASL:
+		case LSR:
+		case ROL:
+		case ROR: {
+			uint16_t addr = m_addrMode == ACCUMULATOR ? 0 : address(r, m);
+			uint8_t value = m_addrMode == ACCUMULATOR ? r.a : m.getValue(addr);
+			uint8_t carry = getFlag(r, S_CARRY);
+			uint8_t result;
+			switch(op) {
+				case ASL:
+					setFlag(r, S_CARRY, value & 0x80);
+					result = value << 1;
+					break;
+				case LSR:
+					setFlag(r, S_CARRY, value & 0x01);
+					result = value >> 1;
+					break;
+				case ROL:
+					setFlag(r, S_CARRY, value & 0x80);
+					result = (value << 1) | carry;
+					break;
+				default:
+					setFlag(r, S_CARRY, value & 0x01);
+					result = (value >> 1) | (carry << 7);
+					break;
+			}
+			setNZ(r, result);
+			if(m_addrMode == ACCUMULATOR)
+				r.a = result;
+			else
+				m.setValue(addr, result);
+			break;
+		}
+		case BIT: {
+			uint8_t value = read(r, m);
+			setFlag(r, S_ZERO, (value & r.a) == 0);
+			setFlag(r, S_OVERFLOW, value & (1 << 6));
+			setFlag(r, S_NEGATIVE, value & (1 << 7));
+			break;
+		}
+		case BCC: if(!getFlag(r, S_CARRY)) pc = operand; break;
+		case BCS: if(getFlag(r, S_CARRY)) pc = operand; break;
+		case BNE: if(!getFlag(r, S_ZERO)) pc = operand; break;
+		case BEQ: if(getFlag(r, S_ZERO)) pc = operand; break;
+		case BPL: if(!getFlag(r, S_NEGATIVE)) pc = operand; break;
+		case BMI: if(getFlag(r, S_NEGATIVE)) pc = operand; break;
+		case BVC: if(!getFlag(r, S_OVERFLOW)) pc = operand; break;
+		case BVS: if(getFlag(r, S_OVERFLOW)) pc = operand; break;
+		case BRK:
+			// BRK skips the byte after it
+			enterInterrupt(r, m, pc, pc + 1, 0xFFFE, true);
+			break;
+		case RTI: {
+			r.s = pop(r, m);
+			setFlag(r, S_INTERRUPT, false);
+			setFlag(r, S_ALWAYS, true);
+			uint16_t ret = pop(r, m);
+			ret |= pop(r, m) << 8;
+			pc = ret;
+			break;
+		}
+		case JMP:
+			pc = m_addrMode == ABSOLUTE ? operand : address(r, m);
+			break;
+		case JSR: {
+			uint16_t ret = pc - 1;
+			push(r, m, ret >> 8);
+			push(r, m, ret & 0xFF);
+			pc = operand;
+			break;
+		}
+		case RTS: {
+			uint16_t ret = pop(r, m);
+			ret |= pop(r, m) << 8;
+			pc = ret + 1;
+			break;
+		}
+		case CLC: setFlag(r, S_CARRY, false); break;
+		case CLD: setFlag(r, S_DECIMAL, false); break;
+		case CLI: setFlag(r, S_INTER_DISABLE, false); break;
+		case CLV: setFlag(r, S_OVERFLOW, false); break;
+		case SEC: setFlag(r, S_CARRY, true); break;
+		case SED: setFlag(r, S_DECIMAL, true); break;
+		case SEI: setFlag(r, S_INTER_DISABLE, true); break;
+		case CMP: compare(r, r.a, read(r, m)); break;
+		case CPX: compare(r, r.x, read(r, m)); break;
+		case CPY: compare(r, r.y, read(r, m)); break;
+		case DEC:
+		case INC: {
+			uint16_t addr = address(r, m);
+			uint8_t value = m.getValue(addr) + (op == INC ? 1 : -1);
+			m.setValue(addr, value);
+			setNZ(r, value);
+			break;
+		}
+		case DEX: r.x--; setNZ(r, r.x); break;
+		case DEY: r.y--; setNZ(r, r.y); break;
+		case INX: r.x++; setNZ(r, r.x); break;
+		case INY: r.y++; setNZ(r, r.y); break;
+		case LDA: r.a = read(r, m); setNZ(r, r.a); break;
+		case LDX: r.x = read(r, m); setNZ(r, r.x); break;
+		case LDY: r.y = read(r, m); setNZ(r, r.y); break;
+		case STA: m.setValue(address(r, m), r.a); break;
+		case STX: m.setValue(address(r, m), r.x); break;
+		case STY: m.setValue(address(r, m), r.y); break;
+		case TAX: r.x = r.a; setNZ(r, r.x); break;
+		case TAY: r.y = r.a; setNZ(r, r.y); break;
+		case TSX: r.x = r.sp; setNZ(r, r.x); break;
+		case TXA: r.a = r.x; setNZ(r, r.a); break;
+		case TYA: r.a = r.y; setNZ(r, r.a); break;
+		case TXS: r.sp = r.x; break;
+		case PHA: push(r, m, r.a); break;
+		case PHP: push(r, m, r.s | (1 << S_INTERRUPT)); break;
+		case PLA: r.a = pop(r, m); setNZ(r, r.a); break;
+		case PLP:
+			r.s = pop(r, m);
+			setFlag(r, S_INTERRUPT, false);
+			setFlag(r, S_ALWAYS, true);
+			break;
+		case NOP:
+			break;
+		case XXX:
+			Instr::run(r, m, pc);
+			break;
+	}
+}
+
+std::string Fallback::format() {
+	switch(m_addrMode) {
+		case IMMEDIATE:   return fmt::format("{} #{:X}", m_name, operand);
+		case ZEROPAGE:
+		case ABSOLUTE:    return fmt::format("{} ${:X}", m_name, operand);
+		case ZEROPAGE_X:
+		case ABSOLUTE_X:  return fmt::format("{} ${:X},X", m_name, operand);
+		case ZEROPAGE_Y:
+		case ABSOLUTE_Y:  return fmt::format("{} ${:X},Y", m_name, operand);
+		case X_INDIRECT:  return fmt::format("{} (${:X},X)", m_name, operand);
+		case INDIRECT_Y:  return fmt::format("{} (${:X}),Y", m_name, operand);
+		case INDIRECT:    return fmt::format("{} (${:X})", m_name, operand);
+		case RELATIVE:    return fmt::format("{} *{:X}", m_name, operand);
+		case ACCUMULATOR: return fmt::format("{} A", m_name);
+		default:          return fmt::format("{}", m_name);
+	}
+}
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "ines.h"
-#include <asmjit/asmjit.h>
+#include "ir.h"
+#include "registers.h"
 
 enum AddrMode {
 	ACCUMULATOR,
@@ -29,8 +30,18 @@ class Instr {
 		Instr(AddrMode addrMode, std::string name, bool cont = true) : cont(cont), m_addrMode(addrMode), m_name(name) {};
 		virtual ~Instr() {};
 		virtual std::string format();
-		virtual bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		// Append the IR for the instruction to the block being compiled
+		virtual void lower(IrBlock& ir);
+		// Interpret the instruction. pc holds the location of the next
+		// instruction and is changed by anything that jumps.
+		virtual void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 		virtual bool stop_jit();
+		// For instructions that stop the JIT: whether a trace can carry on
+		// through them, and at which location
+		virtual bool follow(uint16_t& location);
+		// Whether lower() can handle this instruction. The JIT ends its blocks in
+		// front of anything that can't and leaves it to the interpreter.
+		virtual bool compilable();
 };
 
 class NoArg : public Instr {
@@ -56,6 +67,7 @@ class BranchInstr : public Instr {
 	public:
 		BranchInstr(AddrMode addrMode, std::string name, uint16_t target, uint16_t next) : Instr(addrMode, name, false), target(target), next(next) {};
 		template<class T> static std::unique_ptr<Instr> create(ParserPointer& pp);
+		bool follow(uint16_t& location);
 };
 
 class LDAImmInstr : public Instr {
@@ -65,17 +77,19 @@ class LDAImmInstr : public Instr {
 		LDAImmInstr(uint8_t value) : Instr(AddrMode::IMMEDIATE, "LDA"), value(value) {};
 		static std::unique_ptr<Instr> create(ParserPointer& pp);
 		virtual std::string format();
-		virtual bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		virtual void lower(IrBlock& ir);
+		virtual void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class LDAAbsXInstr : public Instr {
 	private:
 		uint16_t base;
 	public:
-		LDAAbsXInstr() : Instr(AddrMode::ABSOLUTE_X, "LDA") {};
+		LDAAbsXInstr(uint16_t base) : Instr(AddrMode::ABSOLUTE_X, "LDA"), base(base) {};
 		static std::unique_ptr<Instr> create(ParserPointer& pp);
 		virtual std::string format();
-		virtual bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		virtual void lower(IrBlock& ir);
+		virtual void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class LDXImmInstr : public Instr {
@@ -84,7 +98,8 @@ class LDXImmInstr : public Instr {
 		LDXImmInstr(uint8_t value) : Instr(AddrMode::IMMEDIATE, "LDX"), m_value(value) {};
 		static std::unique_ptr<Instr> create(ParserPointer& pp);
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class JMPAbsInstr : public Instr {
@@ -94,7 +109,9 @@ class JMPAbsInstr : public Instr {
 		JMPAbsInstr(uint16_t target) : Instr(AddrMode::ABSOLUTE, "JMP", false), m_target(target) {};
 		static std::unique_ptr<Instr> create(ParserPointer& pp);
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		bool follow(uint16_t& location);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class JSRAbsInstr : public BranchInstr {
@@ -102,30 +119,40 @@ class JSRAbsInstr : public BranchInstr {
 		JSRAbsInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::ABSOLUTE, "JSR", target, next) {};
 		static std::unique_ptr<Instr> create(ParserPointer& pp);
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		bool follow(uint16_t& location);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class RTS : public NoArg {
 	public:
 		RTS() : NoArg(AddrMode::IMPLIED, "RTS") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class ADCImmInstr : public NoArg {
 	public:
 		ADCImmInstr() : NoArg(AddrMode::IMMEDIATE, "ADC") {};
+		bool compilable();
 };
 
 class NOP : public NoArg {
 	public:
 		NOP() : NoArg(AddrMode::IMPLIED, "NOP") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class STAAbsXInstr : public Instr {
+	private:
+		uint16_t base;
 	public:
-		STAAbsXInstr() : Instr(AddrMode::ABSOLUTE_X, "STA") {};
+		STAAbsXInstr(uint16_t base) : Instr(AddrMode::ABSOLUTE_X, "STA"), base(base) {};
 		static std::unique_ptr<Instr> create(ParserPointer& pp);
+		std::string format();
+		bool compilable();
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class STXZeroPInstr : public Instr {
@@ -135,139 +162,199 @@ class STXZeroPInstr : public Instr {
 		STXZeroPInstr(uint8_t operand) : Instr(AddrMode::ZEROPAGE, "STX"), operand(operand) {};
 		static std::unique_ptr<Instr> create(ParserPointer& pp);
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class SEC : public NoArg {
 	public:
 		SEC() : NoArg(AddrMode::IMPLIED, "SEC") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class CLC : public NoArg {
 	public:
 		CLC() : NoArg(AddrMode::IMPLIED, "CLC") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class SEI : public NoArg {
 	public:
 		SEI() : NoArg(AddrMode::IMPLIED, "SEI") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class SED : public NoArg {
 	public:
 		SED() : NoArg(AddrMode::IMPLIED, "SED") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class CLD : public NoArg {
 	public:
 		CLD() : NoArg(AddrMode::IMPLIED, "CLD") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class PHP : public NoArg {
 	public:
 		PHP() : NoArg(AddrMode::IMPLIED, "PHP") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class PLA : public NoArg {
 	public:
 		PLA() : NoArg(AddrMode::IMPLIED, "PLA") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class PLP : public NoArg {
 	public:
 		PLP() : NoArg(AddrMode::IMPLIED, "PLP") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class PHA : public NoArg {
 	public:
 		PHA() : NoArg(AddrMode::IMPLIED, "PHA") {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BCSRelInstr : public BranchInstr {
 	public:
-		BCSRelInstr(uint8_t operand, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BCS", operand, next) {};
+		BCSRelInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BCS", target, next) {};
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BCCRelInstr : public BranchInstr {
 	public:
-		BCCRelInstr(uint8_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BCC", target, next) {};
+		BCCRelInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BCC", target, next) {};
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BVSRelInstr : public BranchInstr {
 	public:
-		BVSRelInstr(uint8_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BVS", target, next) {};
+		BVSRelInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BVS", target, next) {};
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BVCRelInstr : public BranchInstr {
 	public:
-		BVCRelInstr(uint8_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BVC", target, next) {};
+		BVCRelInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BVC", target, next) {};
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BEQRelInstr : public BranchInstr {
 	public:
-		BEQRelInstr(uint8_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BEQ", target, next) {};
+		BEQRelInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BEQ", target, next) {};
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BNERelInstr : public BranchInstr {
 	public:
-		BNERelInstr(uint8_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BNE", target, next) {};
+		BNERelInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BNE", target, next) {};
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BPLRelInstr : public BranchInstr {
 	public:
-		BPLRelInstr(uint8_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BPL", target, next) {};
+		BPLRelInstr(uint16_t target, uint16_t next) : BranchInstr(AddrMode::RELATIVE, "BPL", target, next) {};
 		std::string format();
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class STAZeroP : public SingleByte {
 	public:
 		STAZeroP(uint8_t operand) : SingleByte(AddrMode::ZEROPAGE, "STA", operand) {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class BITZeroP : public SingleByte {
 	public:
 		BITZeroP(uint8_t operand) : SingleByte(AddrMode::ZEROPAGE, "BIT", operand) {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class ANDImm : public SingleByte {
 	public:
 		ANDImm(uint8_t operand) : SingleByte(AddrMode::IMMEDIATE, "AND", operand) {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
 class CMPImm : public SingleByte {
 	public:
 		CMPImm(uint8_t operand) : SingleByte(AddrMode::IMMEDIATE, "CMP", operand) {};
-		bool exp(asmjit::X86Assembler& assembler, MemoryMapper& m);
+		void lower(IrBlock& ir);
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
+};
+
+// Generic decoding for every official opcode that doesn't have its own Instr
+// yet. They can only be interpreted.
+class Fallback : public Instr {
+	public:
+		enum Op {
+			XXX, ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE,
+			BPL, BRK, BVC, BVS, CLC, CLD, CLI, CLV, CMP, CPX,
+			CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP, JSR,
+			LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP,
+			ROL, ROR, RTI, RTS, SBC, SEC, SED, SEI, STA, STX,
+			STY, TAX, TAY, TSX, TXA, TXS, TYA,
+		};
+	private:
+		struct Entry {
+			Op op;
+			AddrMode mode;
+		};
+		static const Entry table[256];
+		static const char* names[];
+
+		Op op;
+		uint16_t operand;
+
+		uint16_t address(CpuContext& r, MemoryMapper& m);
+		uint8_t read(CpuContext& r, MemoryMapper& m);
+	public:
+		Fallback(Op op, AddrMode addrMode, uint16_t operand, bool cont) : Instr(addrMode, names[op], cont), op(op), operand(operand) {};
+		// Returns null for the undocumented opcodes
+		static std::unique_ptr<Instr> create(uint8_t opcode, ParserPointer& pp);
+		std::string format();
+		bool compilable();
+		void run(CpuContext& r, MemoryMapper& m, uint16_t& pc);
 };
 
-
 typedef std::unique_ptr<Instr> (*CompileFunc)(ParserPointer& pp);
 
+extern const uint8_t opcodeCycles[256];
+
+// What BRK, NMI and IRQ have in common. Pushes ret and the status, with the
+// break bit only for BRK, and continues at the handler the vector points to.
+void enterInterrupt(CpuContext& r, MemoryMapper& m, uint16_t& pc, uint16_t ret, uint16_t vector, bool brk);
+
 static const CompileFunc opcodeTable[256] = {
 //  0x00                             , 0x01                       , 0x02                , 0x03                , 0x04                         , 0x05                         , 0x06                  , 0x07 ,
 //  0x08                             , 0x09                       , 0x0A                , 0x0B                , 0x0C                         , 0x0D                         , 0x0E                  , 0x0F ,
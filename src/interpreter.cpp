@@ -0,0 +1,38 @@
+#include "interpreter.h"
+
+uint16_t interpret(Block& block, CpuContext& r, MemoryMapper& m) {
+	// The decoded instructions are the threaded code. Each one knows where
+	// its successor is, so we only leave the block when something jumps.
+	auto& instrs = *block.instrs;
+	for(size_t i = 0; i < instrs.size(); i++) {
+		uint16_t next = (i + 1 < instrs.size()) ? block.locations[i + 1] : block.end;
+		uint16_t pc = next;
+		r.budget -= block.cycles[i];
+		instrs[i]->run(r, m, pc);
+		if(pc != next) {
+			// Taken branches cost one more, and another for landing on a
+			// different page
+			if(instrs[i]->m_addrMode == RELATIVE)
+				r.budget -= (pc & 0xFF00) != (next & 0xFF00) ? 2 : 1;
+			return pc;
+		}
+	}
+	return block.end;
+}
+
+uint16_t interrupt(CpuContext& r, MemoryMapper& m, uint16_t pc) {
+	uint16_t vector;
+	if(r.pending & (1 << INT_NMI)) {
+		r.pending &= ~(1 << INT_NMI);
+		vector = 0xFFFA;
+	} else if((r.pending & (1 << INT_IRQ)) && !(r.s & (1 << S_INTER_DISABLE))) {
+		vector = 0xFFFE;
+	} else {
+		return pc;
+	}
+
+	// Same sequence as BRK
+	enterInterrupt(r, m, pc, pc, vector, false);
+	r.budget -= 7;
+	return pc;
+}
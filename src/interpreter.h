@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "block.h"
+#include "registers.h"
+#include "mapper/memorymapper.h"
+
+// Tier 0. Runs an already decoded block one instruction at a time and
+// returns the guest address execution continues at.
+uint16_t interpret(Block& block, CpuContext& r, MemoryMapper& m);
+// Take the most urgent of the pending interrupts the CPU isn't masking,
+// with the guest about to run the instruction at pc. Returns where it
+// continues.
+uint16_t interrupt(CpuContext& r, MemoryMapper& m, uint16_t pc);
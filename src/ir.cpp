@@ -0,0 +1,271 @@
+#include "ir.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+
+#include "registers.h"
+
+#define FLAGS_NZ ((1 << S_NEGATIVE) | (1 << S_ZERO))
+
+uint8_t IrInstr::flagsRead() const {
+	switch(op) {
+		// Anything leaving the block might be observed by the next one
+		case IrOp::BRANCH:
+		case IrOp::JUMP:
+		case IrOp::JUMP_IND:
+		case IrOp::PUSH_FLAGS:
+			return 0xFF;
+		default:
+			return 0;
+	}
+}
+
+uint8_t IrInstr::flagsWritten() const {
+	switch(op) {
+		case IrOp::POP_FLAGS:
+			return 0xFF;
+		case IrOp::SET_FLAG:
+			return 1 << flag;
+		default:
+			return flags;
+	}
+}
+
+bool IrInstr::clobbersHostFlags() const {
+	switch(op) {
+		case IrOp::NOP:
+		case IrOp::LOAD_IMM:
+		case IrOp::SET_FLAG:
+		case IrOp::BRANCH:
+		case IrOp::JUMP:
+			return false;
+		case IrOp::LABEL:
+			// Everyone arriving at the label needs the flags in REG_S
+			return true;
+		case IrOp::MOV:
+			// Only if we need a test for the flags
+			return flags != 0;
+		default:
+			return true;
+	}
+}
+
+static const char* regName(IrReg reg) {
+	static const char* names[] = { "A", "X", "Y", "SP", "T0", "T1", "-" };
+	return names[reg];
+}
+
+std::string IrInstr::format() const {
+	static const char* names[] = {
+		"nop", "load_imm", "mov", "and", "or", "xor", "cmp", "test", "flags_vn",
+		"load", "load_idx", "store", "store_idx", "push", "pop", "push_flags",
+		"pop_flags", "set_flag", "branch", "jump", "jump_ind", "label",
+	};
+	std::string operand = src == IR_NONE ? fmt::format("#{:X}", imm) : regName(src);
+	std::string out;
+	switch(op) {
+		case IrOp::LOAD:
+		case IrOp::LOAD_IDX:
+			out = fmt::format("{} {}, [{:X}{}{}]", names[(int)op], regName(dst), imm, src != IR_NONE ? "+" : "", src != IR_NONE ? regName(src) : "");
+			break;
+		case IrOp::STORE:
+		case IrOp::STORE_IDX:
+			out = fmt::format("{} [{:X}{}{}], {}", names[(int)op], imm, src2 != IR_NONE ? "+" : "", src2 != IR_NONE ? regName(src2) : "", regName(src));
+			break;
+		case IrOp::SET_FLAG:
+			out = fmt::format("{} {}, {}", names[(int)op], flag, value);
+			break;
+		case IrOp::BRANCH:
+			out = fmt::format("{} {}={}, {:X}{}", names[(int)op], flag, value, target, local ? " (loop)" : "");
+			break;
+		case IrOp::JUMP:
+			out = fmt::format("{} {:X}{}", names[(int)op], target, local ? " (loop)" : "");
+			break;
+		case IrOp::LABEL:
+			out = fmt::format("{} {:X}", names[(int)op], target);
+			break;
+		case IrOp::JUMP_IND:
+			out = fmt::format("{} {}:{}+{}", names[(int)op], regName(src2), regName(src), imm);
+			break;
+		default:
+			out = fmt::format("{} {}, {}", names[(int)op], regName(dst), operand);
+			break;
+	}
+	if(flags != 0)
+		out += fmt::format(" ; flags {:#010b}", flags);
+	return out;
+}
+
+void IrBlock::setLocation(uint16_t location, int32_t following, uint8_t cycles) {
+	// Cycles the Instrs before left unpaid go in a NOP of their own, so a
+	// loop head placed here doesn't take them into the loop. removeNops
+	// hands them to the LABEL.
+	if(this->cycles != 0)
+		add(IrOp::NOP);
+	this->location = location;
+	this->following = following;
+	this->cycles += cycles;
+	starts.emplace(location, instrs.size());
+}
+
+bool IrBlock::follows(uint16_t target) {
+	return following == target;
+}
+
+IrInstr& IrBlock::add(IrOp op) {
+	IrInstr instr = {};
+	instr.op = op;
+	instr.dst = IR_NONE;
+	instr.src = IR_NONE;
+	instr.src2 = IR_NONE;
+	instr.location = location;
+	instr.cycles = cycles;
+	cycles = 0;
+	instrs.push_back(instr);
+	return instrs.back();
+}
+
+void IrBlock::loadImm(IrReg dst, uint8_t value) {
+	auto& i = add(IrOp::LOAD_IMM);
+	i.dst = dst;
+	i.imm = value;
+	i.flags = FLAGS_NZ;
+}
+
+void IrBlock::mov(IrReg dst, IrReg src) {
+	auto& i = add(IrOp::MOV);
+	i.dst = dst;
+	i.src = src;
+	i.flags = FLAGS_NZ;
+}
+
+void IrBlock::alu(IrOp op, IrReg dst, IrReg src) {
+	auto& i = add(op);
+	i.dst = dst;
+	i.src = src;
+	i.flags = FLAGS_NZ;
+	if(op == IrOp::CMP)
+		i.flags |= 1 << S_CARRY;
+	if(op == IrOp::TEST)
+		i.flags = 1 << S_ZERO;
+}
+
+void IrBlock::aluImm(IrOp op, IrReg dst, uint8_t value) {
+	alu(op, dst, IR_NONE);
+	instrs.back().imm = value;
+}
+
+void IrBlock::flagsVN(IrReg src) {
+	auto& i = add(IrOp::FLAGS_VN);
+	i.src = src;
+	i.flags = (1 << S_OVERFLOW) | (1 << S_NEGATIVE);
+}
+
+void IrBlock::load(IrReg dst, uint16_t addr, bool setNZ) {
+	auto& i = add(IrOp::LOAD);
+	i.dst = dst;
+	i.imm = addr;
+	i.flags = setNZ ? FLAGS_NZ : 0;
+}
+
+void IrBlock::loadIdx(IrReg dst, uint16_t base, IrReg index) {
+	auto& i = add(IrOp::LOAD_IDX);
+	i.dst = dst;
+	i.src = index;
+	i.imm = base;
+	i.flags = FLAGS_NZ;
+}
+
+void IrBlock::store(uint16_t addr, IrReg src) {
+	auto& i = add(IrOp::STORE);
+	i.src = src;
+	i.imm = addr;
+}
+
+void IrBlock::storeIdx(uint16_t base, IrReg index, IrReg src) {
+	auto& i = add(IrOp::STORE_IDX);
+	i.src = src;
+	i.src2 = index;
+	i.imm = base;
+}
+
+void IrBlock::push(IrReg src) {
+	auto& i = add(IrOp::PUSH);
+	i.src = src;
+}
+
+void IrBlock::pushImm(uint8_t value) {
+	auto& i = add(IrOp::PUSH);
+	i.imm = value;
+}
+
+void IrBlock::pop(IrReg dst) {
+	auto& i = add(IrOp::POP);
+	i.dst = dst;
+}
+
+void IrBlock::pushFlags() {
+	add(IrOp::PUSH_FLAGS);
+}
+
+void IrBlock::popFlags() {
+	add(IrOp::POP_FLAGS);
+}
+
+void IrBlock::setFlag(int flag, bool value) {
+	auto& i = add(IrOp::SET_FLAG);
+	i.flag = flag;
+	i.value = value;
+}
+
+void IrBlock::branch(int flag, bool value, uint16_t target) {
+	auto& i = add(IrOp::BRANCH);
+	i.flag = flag;
+	i.value = value;
+	i.target = target;
+	i.local = starts.count(target) != 0;
+	if(i.local)
+		heads.push_back(target);
+}
+
+void IrBlock::jump(uint16_t target) {
+	auto& i = add(IrOp::JUMP);
+	i.target = target;
+	i.local = starts.count(target) != 0;
+	if(i.local)
+		heads.push_back(target);
+}
+
+void IrBlock::continueAt(uint16_t target) {
+	if(!follows(target))
+		jump(target);
+}
+
+void IrBlock::jumpInd(IrReg low, IrReg high, uint16_t offset) {
+	auto& i = add(IrOp::JUMP_IND);
+	i.src = low;
+	i.src2 = high;
+	i.imm = offset;
+}
+
+void IrBlock::placeLoopHeads() {
+	std::sort(heads.begin(), heads.end(), [&](uint16_t a, uint16_t b) {
+		if(starts[a] != starts[b])
+			return starts[a] > starts[b];
+		return a < b;
+	});
+	heads.erase(std::unique(heads.begin(), heads.end()), heads.end());
+
+	// Back to front, so the indices further up stay valid
+	for(uint16_t head : heads) {
+		IrInstr label = {};
+		label.op = IrOp::LABEL;
+		label.dst = IR_NONE;
+		label.src = IR_NONE;
+		label.src2 = IR_NONE;
+		label.target = head;
+		label.location = head;
+		instrs.insert(instrs.begin() + starts[head], label);
+	}
+	heads.clear();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+// Registers the IR works on. The guest registers are fixed, the temporaries
+// only live within a block.
+enum IrReg : uint8_t {
+	IR_A,
+	IR_X,
+	IR_Y,
+	IR_SP,
+	IR_T0,
+	IR_T1,
+	IR_NONE,
+};
+
+enum class IrOp {
+	NOP,
+	LOAD_IMM,   // dst = imm
+	MOV,        // dst = src
+	AND,        // dst &= src or imm
+	OR,         // dst |= src or imm
+	XOR,        // dst ^= src or imm
+	CMP,        // Flags of dst - (src or imm)
+	TEST,       // Flags of dst & (src or imm)
+	FLAGS_VN,   // V and N are bit 6 and 7 of src
+	LOAD,       // dst = mem[imm]
+	LOAD_IDX,   // dst = mem[imm + src], a cycle more if that crosses a page
+	STORE,      // mem[imm] = src
+	STORE_IDX,  // mem[imm + src2] = src
+	PUSH,       // Push src or imm on the guest stack
+	POP,        // Pop dst from the guest stack
+	PUSH_FLAGS, // Push the status register with the break bit set
+	POP_FLAGS,  // Pull the status register
+	SET_FLAG,   // Set flag to value
+	BRANCH,     // Leave for target if flag has value, otherwise fall through
+	JUMP,       // Leave for target
+	JUMP_IND,   // Leave for (src2 << 8 | src) + imm
+	LABEL,      // Head of a loop at guest location target
+};
+
+struct IrInstr {
+	IrOp op;
+	IrReg dst;
+	IrReg src;
+	IrReg src2;
+	uint16_t imm;
+	// Status flags this instruction defines. Dead ones get cleared by the
+	// optimizer and are never computed.
+	uint8_t flags;
+	// For SET_FLAG and BRANCH
+	uint8_t flag;
+	bool value;
+	uint16_t target;
+	// For BRANCH and JUMP: target is a LABEL earlier in the block
+	bool local;
+	// Guest location of the instruction this came from
+	uint16_t location;
+	// Base cycles of the guest instructions that start here. Whatever drops
+	// an instruction has to hand them on.
+	uint16_t cycles;
+
+	// Flags read before anything else gets a chance to redefine them
+	uint8_t flagsRead() const;
+	// Flags that are defined no matter what the optimizer has done
+	uint8_t flagsWritten() const;
+	// Whether the x86 code for this needs the host flags to itself
+	bool clobbersHostFlags() const;
+	std::string format() const;
+};
+
+// A linear list of IR instructions, built by the decoded Instrs of a block
+class IrBlock {
+	private:
+		uint16_t location;
+		// Location of the instruction after the current one in the trace, -1
+		// at the end of it
+		int32_t following;
+		// Cycles of the Instrs that haven't produced an IR instruction yet
+		uint16_t cycles;
+		// Index of the first IR instruction of each guest location lowered
+		// so far
+		std::unordered_map<uint16_t, size_t> starts;
+		std::vector<uint16_t> heads;
+
+		IrInstr& add(IrOp op);
+	public:
+		std::vector<IrInstr> instrs;
+
+		IrBlock() : location(0), following(-1), cycles(0) {};
+
+		// Guest location of the Instr being lowered and of the one after it,
+		// and the number of cycles the Instr takes
+		void setLocation(uint16_t location, int32_t following, uint8_t cycles);
+		// Whether the trace carries on at target after the current Instr
+		bool follows(uint16_t target);
+
+		void loadImm(IrReg dst, uint8_t value);
+		void mov(IrReg dst, IrReg src);
+		void alu(IrOp op, IrReg dst, IrReg src);
+		void aluImm(IrOp op, IrReg dst, uint8_t value);
+		void flagsVN(IrReg src);
+		// Loads set N and Z from the value unless told otherwise
+		void load(IrReg dst, uint16_t addr, bool setNZ = true);
+		void loadIdx(IrReg dst, uint16_t base, IrReg index);
+		void store(uint16_t addr, IrReg src);
+		void storeIdx(uint16_t base, IrReg index, IrReg src);
+		void push(IrReg src);
+		void pushImm(uint8_t value);
+		void pop(IrReg dst);
+		void pushFlags();
+		void popFlags();
+		void setFlag(int flag, bool value);
+		void branch(int flag, bool value, uint16_t target);
+		void jump(uint16_t target);
+		// Jump to target, unless that's where the trace goes anyway
+		void continueAt(uint16_t target);
+		void jumpInd(IrReg low, IrReg high, uint16_t offset);
+
+		// Branches and jumps back to a location earlier in the block stay
+		// inside it as loops. Once everything is lowered this puts a LABEL in
+		// front of every location they go to.
+		void placeLoopHeads();
+};
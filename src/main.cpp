@@ -3,8 +3,16 @@
 #include <iostream>
 #include <fmt/format.h>
 #include <unistd.h>
+#include <algorithm>
 #include "instruction.h"
 #include "ines.h"
+#include "codecache.h"
+#include "emitter.h"
+#include "backend.h"
+#include "interpreter.h"
+#include "optimizer.h"
+#include "registers.h"
+#include "scheduler.h"
 
 #include <glad/glad.h>
 #include <SDL.h>
@@ -14,54 +22,166 @@
 #include "polym/msg.hpp"
 #include "polym/queue.hpp"
 
-struct CpuState {
-	uint8_t SP;
-	uint8_t S;
-	uint8_t A;
-	uint8_t X;
-	uint8_t Y;
-};
-
 template<class T, class U>
 std::unique_ptr<T> unique_static_cast(std::unique_ptr<U>& ptr) {
 	return std::unique_ptr<T>(static_cast<T*>(ptr.release()));
 }
 
-// Signature of the generated function.
-typedef void (*Func)(void);
-
 struct Context {
 	INes& game;
 	MemoryMapper& mapper;
 	asmjit::JitRuntime& rt;
-	
-	uint16_t location;
-	struct CpuState exitState; // Set when the jit function can be reentered
-} *context;
+	CodeArena& arena;
+	CodeCache& cache;
+	Scheduler& scheduler;
 
-// Careful here. These are written to directly from the assembly wrapper
-struct Registers {
-	uint8_t sp;
-	uint8_t s;
-	uint8_t a;
-	uint8_t x;
-	uint8_t y;
-};
+	// Number of interpreted runs before a block is compiled
+	uint32_t threshold;
+	// Most base cycles in a trace. Interrupts are only looked at between
+	// blocks and on loop back edges, so this bounds how late they are taken.
+	uint32_t latency;
+
+	CpuContext cpu;
+} *context;
 
-extern "C" void outer_jit_wrapper(uint16_t target);
+// Run the guest from target until the compiler gives up, with the registers
+// in cpu
+extern "C" void outer_jit_wrapper(uint16_t target, CpuContext* cpu);
 
 #include <thread>
 
 PolyM::Queue jitQueue;
 PolyM::Queue guiQueue;
 
-extern "C" uint64_t jit(uint16_t target, struct Registers* saved_registers) {
-	// @HACK: Location should be passed in to the context maybe?
-	context->location = target;
+// Upper bound on the number of instructions in a trace
+#define MAX_TRACE_LENGTH 64
+
+// NTSC frame timing in master clock ticks
+#define FRAME_TICKS (341 * 262 * MASTER_PER_DOT)
+#define VBLANK_TICKS ((241 * 341 + 1) * MASTER_PER_DOT)
+// The 4 step sequence of the APU frame counter
+#define APU_FRAME_TICKS (29830 * MASTER_PER_CPU)
+
+// Stands in for the PPU and the APU until they are emulated. Keeps their
+// events coming at the right rate, so the CPU is stopped as often as it
+// will be with them.
+class Timing : public EventHandler {
+	private:
+		Scheduler& scheduler;
+		MemoryMapper& mapper;
+		CpuContext& cpu;
+	public:
+		Timing(Scheduler& scheduler, MemoryMapper& mapper, CpuContext& cpu) : scheduler(scheduler), mapper(mapper), cpu(cpu) {
+			scheduler.setHandler(EVENT_VBLANK, this);
+			scheduler.setHandler(EVENT_APU_FRAME, this);
+			scheduler.schedule(EVENT_VBLANK, VBLANK_TICKS);
+			scheduler.schedule(EVENT_APU_FRAME, APU_FRAME_TICKS - MASTER_PER_CPU);
+		}
+
+		void fire(Event event, uint64_t time) {
+			// Rescheduled from the time they were due rather than now, so they
+			// don't drift
+			switch(event) {
+				case EVENT_VBLANK:
+					// @HACK The PPU registers only hold what was written to
+					// them, but that's enough to know if PPUCTRL wants the NMI
+					if(mapper.getValue(0x2000) & 0x80)
+						cpu.pending |= 1 << INT_NMI;
+					scheduler.schedule(EVENT_VBLANK, time + FRAME_TICKS);
+					break;
+				case EVENT_APU_FRAME:
+					// @COMPLETENESS The frame IRQ needs $4015 and $4017 to be
+					// acknowledged and inhibited
+					scheduler.schedule(EVENT_APU_FRAME, time + APU_FRAME_TICKS);
+					break;
+				default:
+					break;
+			}
+		}
+};
+
+static Block* decode(uint16_t location) {
+	ParserPointer pp(context->mapper, location);
+
+	auto block = std::make_unique<Block>(location);
+
+	// Decode a trace, following unconditional jumps and the fall through path
+	// of branches until we run into something we can't follow, something
+	// already in the trace or the size budget
+	uint16_t rangeStart = location;
+	uint32_t cycles = 0;
+	auto closeRange = [&]() {
+		if(pp.getLocation() != rangeStart)
+			block->ranges.push_back({rangeStart, pp.getLocation()});
+	};
+	while(true) {
+		uint16_t instrLocation = pp.getLocation();
+		// A bank switched in under the rest of the trace wouldn't be noticed,
+		// see CodeCache
+		uint8_t page = instrLocation >> 8;
+		if(page != (location >> 8) && context->mapper.isSwitchable(page))
+			break;
+
+		uint8_t b = pp.next();
+		auto ic = opcodeTable[b];
+		auto i = ic != nullptr ? ic(pp) : Fallback::create(b, pp);
+		if(i == nullptr) {
+			fmt::print("Unknown opcode 0x{0:X} ({0}) at location {1:X}, ABORT\n", b, instrLocation);
+			return nullptr;
+		}
 
-	guiQueue.put(PolyM::DataMsg<struct Registers>(1, *saved_registers));
+		// Instructions the JIT can't emit get a block of their own, so
+		// everything around them can still be compiled
+		if(!i->compilable()) {
+			if(!block->instrs->empty()) {
+				pp.jump(instrLocation);
+				break;
+			}
+			block->compilable = false;
+			block->instrs->push_back(std::move(i));
+			block->locations.push_back(instrLocation);
+			block->cycles.push_back(opcodeCycles[b]);
+			break;
+		}
 
-	fmt::print("Jitting block starting at {:X}\n", context->location);
+		bool stop = i->stop_jit();
+		uint16_t follow;
+		bool canFollow = stop && i->follow(follow);
+		block->instrs->push_back(std::move(i));
+		block->locations.push_back(instrLocation);
+		block->cycles.push_back(opcodeCycles[b]);
+
+		cycles += opcodeCycles[b];
+		if(block->instrs->size() >= MAX_TRACE_LENGTH || cycles >= context->latency)
+			break;
+		if(!stop)
+			continue;
+
+		auto& locations = block->locations;
+		if(!canFollow || std::find(locations.begin(), locations.end(), follow) != locations.end())
+			break;
+		if(follow != pp.getLocation()) {
+			closeRange();
+			pp.jump(follow);
+			rangeStart = follow;
+		}
+	}
+	closeRange();
+	block->end = pp.getLocation();
+
+	return context->cache.insert(std::move(block));
+}
+
+static Func compile(Block* block) {
+	fmt::print(
+		"Jitting block starting at {:X} after {} runs (cache: {} hits, {} misses, {}K of {}K code)\n",
+		block->start,
+		block->runs,
+		context->cache.getHits(),
+		context->cache.getMisses(),
+		context->arena.getUsed() >> 10,
+		context->arena.getCapacity() >> 10
+	);
 
 	asmjit::StringLogger logger;
 	logger.addOptions(asmjit::Logger::kOptionHexImmediate);
@@ -70,57 +190,138 @@ extern "C" uint64_t jit(uint16_t target, struct Registers* saved_registers) {
 	code.setLogger(&logger);
 
 	asmjit::X86Assembler a(&code);                 // Create and attach X86Assembler to `code`.
+	Emitter e(a);
 
-	ParserPointer pp(context->mapper, context->location);
-
-	auto block = std::make_shared<std::vector<std::unique_ptr<Instr>>>();
-
-	bool cont = true;
-	while(cont) {
-		uint8_t b = pp.next();
-		auto ic = opcodeTable[b];
-		if(ic == nullptr) {
-			fmt::print("Unknown opcode 0x{0:X} ({0}) at location {1:X}, ABORT\n", b, pp.getLocation());
-			return 0;
-		}
-		auto i = ic(pp);
-		cont = !i->stop_jit();
-		block->push_back(std::move(i));
-	}
-
-	fmt::print("The current block has addr {}\n", (void*)(block.get()));
+	fmt::print("The current block has addr {}\n", (void*)(block->instrs.get()));
 
 	// Now that we have a block, we can ask the ui if this should be shown
-	guiQueue.put(PolyM::DataMsg<std::shared_ptr<std::vector<std::unique_ptr<Instr>>>>(2, block));
+	guiQueue.put(PolyM::DataMsg<std::shared_ptr<std::vector<std::unique_ptr<Instr>>>>(2, block->instrs));
 	auto msg = jitQueue.get(-1);
 	
-	for(auto &instr : *block) {
-		a.comment(fmt::format("; {}", instr->format()).c_str());
-		instr->exp(a, context->mapper);
+	IrBlock ir;
+	try {
+		auto& locations = block->locations;
+		for(size_t i = 0; i < block->instrs->size(); i++) {
+			int32_t following = i + 1 < locations.size() ? locations[i + 1] : -1;
+			ir.setLocation(locations[i], following, block->cycles[i]);
+			(*block->instrs)[i]->lower(ir);
+		}
+
+		// The block was cut short in front of something the interpreter has
+		// to handle, continue there
+		if(!block->instrs->back()->stop_jit())
+			ir.jump(block->end);
+		ir.placeLoopHeads();
+
+		optimize(ir);
+		Backend(a, context->mapper, e).emit(ir);
+	} catch(std::logic_error& err) {
+		// Leave it to the interpreter rather than giving up on the program
+		fmt::print("{}, interpreting the block instead\n", err.what());
+		block->compilable = false;
+		return nullptr;
 	}
+
 	/* fmt::print("\nGenerated code\n"); */
 	/* fmt::print("{}\n", logger.getString()); */
 
-	Func fn;
-	asmjit::Error err = context->rt.add(&fn, &code);
-	if (err) {
-		fmt::print("Failed adding the code to the runtime");
-		return 0;
+	Func fn = context->arena.add(code);
+	if(fn == nullptr) {
+		// We're called from the dispatcher, so none of the old code is
+		// running. The block goes too, the interpreter runs it this time and
+		// it gets decoded again next time.
+		fmt::print("The code arena is full\n");
+		context->cache.flush();
+		return nullptr;
 	}
 
-	// @COMPLETENESS: Ideally we would also save the jit result to make sure we
-	// don't have to do it again.
-	// @LEAK: We are leaking the function here. We should save that somewhere
-	// and free it when we exit
-	return (uint64_t)fn;
+	// The code lives until the cache is flushed. This also links the exits
+	// of it and its neighbours
+	block->fn = fn;
+	e.resolve(*block, code);
+	context->cache.compiled(block);
+	return fn;
+}
+
+extern "C" uint64_t jit(uint16_t target, CpuContext* cpu) {
+	// We came here from the dispatcher, so no generated code is running
+	jit_exit_requested = 0;
+	context->cache.collect();
+
+	// Interpret until we hit compiled code or a block gets hot. Anything the
+	// interpreter changes is loaded back into the registers by fun.S
+	cpu->pc = target;
+	while(true) {
+		// Same convention as the exits of generated code, at 0 the next event
+		// is due
+		if(cpu->budget <= 0)
+			context->scheduler.run(*cpu);
+		// Either the scheduler raised something or the last block unmasked
+		// what was already pending
+		if(cpu->pending != 0)
+			cpu->pc = interrupt(*cpu, context->mapper, cpu->pc);
+
+		uint16_t location = cpu->pc;
+		Block* block = context->cache.lookup(location);
+		if(block == nullptr)
+			block = decode(location);
+		if(block == nullptr)
+			return 0;
+
+		if(block->fn != nullptr)
+			return (uint64_t)block->fn;
+
+		block->runs++;
+		if(block->compilable && block->runs >= context->threshold) {
+			guiQueue.put(PolyM::DataMsg<CpuContext>(1, *cpu));
+			Func fn = compile(block);
+			if(fn != nullptr)
+				return (uint64_t)fn;
+		}
+
+		cpu->pc = interpret(*block, *cpu, context->mapper);
+	}
 }
 
 void call_from_thread() {
 	//Compile starting at the progstart location
-	outer_jit_wrapper(0xC000);
+	outer_jit_wrapper(0xC000, &context->cpu);
 }
 
 int main(int argc, char* argv[]) {
+	uint32_t threshold = 16;
+	bool fastmem = false;
+	// Megabytes of generated code before the cache is flushed
+	size_t arenaSize = 32;
+	// Cycles an interrupt can be late at most
+	uint32_t latency = 128;
+
+	int opt;
+	while((opt = getopt(argc, argv, "t:fc:l:p")) != -1) {
+		switch(opt) {
+			case 't':
+				threshold = atoi(optarg);
+				break;
+			case 'c':
+				arenaSize = atoi(optarg);
+				break;
+			case 'f':
+				fastmem = true;
+				break;
+			case 'l':
+				latency = atoi(optarg);
+				break;
+			case 'p':
+				// Every instruction is a block of its own, so interrupts and
+				// events happen at the exact instruction they are due at
+				latency = 0;
+				break;
+			default:
+				fmt::print("Usage: {} [-t threshold] [-f] [-c code MB] [-l latency | -p]\n", argv[0]);
+				return -1;
+		}
+	}
+
 	// Setup SDL
 	if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_TIMER) != 0)
 	{
@@ -162,17 +363,38 @@ int main(int argc, char* argv[]) {
 
 	// Open file
 	INes f("game.nes");
+	if(fastmem)
+		f.getMapper().enableFastMem();
+
+	CodeArena arena(arenaSize << 20);
+	CodeCache cache(arena, f.getMapper());
+	Scheduler scheduler(latency);
 
 	Context con{
 		f,
 		f.getMapper(),
-		rt
+		rt,
+		arena,
+		cache,
+		scheduler,
+		threshold,
+		latency
 	};
 	context = &con;
 
+	auto& cpu = con.cpu;
+	cpu.sp = 0xFF;
+	// The always bit
+	cpu.s = 0x20;
+	cpu.readPages = f.getMapper().getReadPages();
+	cpu.writePages = f.getMapper().getWritePages();
+	Timing timing(scheduler, f.getMapper(), cpu);
+	// The budget up to the first event
+	scheduler.run(cpu);
+
 	std::thread jitThread(call_from_thread);
 
-	struct Registers regs;
+	CpuContext regs = {};
 	std::shared_ptr<std::vector<std::unique_ptr<Instr>>> currentBlock = nullptr;
 
 	// Main loop
@@ -183,7 +405,7 @@ int main(int argc, char* argv[]) {
 		if(msg->getMsgId() != PolyM::MSG_TIMEOUT) {
 			switch(msg->getMsgId()) {
 				case 1:
-					regs = unique_static_cast<PolyM::DataMsg<struct Registers>>(msg)->getPayload();
+					regs = unique_static_cast<PolyM::DataMsg<CpuContext>>(msg)->getPayload();
 					break;
 				case 2:
 					currentBlock = unique_static_cast<PolyM::DataMsg<std::shared_ptr<std::vector<std::unique_ptr<Instr>>>>>(msg)->getPayload();
@@ -0,0 +1,52 @@
+#include "mapper/board.h"
+#include "mapper/boards.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <fmt/format.h>
+
+Board::Board(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize) :
+	mapper(mapper),
+	prg(prg),
+	prgSize(prgSize) {
+}
+
+Board::~Board() {
+	mapper.setHandler(0x80, 0x80, nullptr);
+}
+
+void Board::mapPrg(uint16_t addr, size_t size, int32_t bank, bool switchable) {
+	// A ROM smaller than the window shows up in it repeatedly
+	size_t chunk = std::min(size, prgSize);
+	int64_t banks = std::max<size_t>(prgSize / size, 1);
+	size_t index = ((bank % banks) + banks) % banks;
+	for(size_t done = 0; done < size; done += chunk)
+		mapper.map((addr + done) >> 8, chunk >> 8, prg, index * chunk, switchable);
+}
+
+template<class T>
+static std::unique_ptr<Board> create(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize) {
+	return std::make_unique<T>(mapper, prg, prgSize);
+}
+
+static const struct {
+	uint16_t number;
+	const char* name;
+	std::unique_ptr<Board> (*create)(MemoryMapper&, std::shared_ptr<MemoryBank>, size_t);
+} boards[] = {
+	{0, "NROM", create<Nrom>},
+	{1, "MMC1", create<Mmc1>},
+	{2, "UxROM", create<Uxrom>},
+	{3, "CNROM", create<Cnrom>},
+	{4, "MMC3", create<Mmc3>},
+};
+
+std::unique_ptr<Board> createBoard(uint16_t number, MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize) {
+	for(auto& board : boards) {
+		if(board.number != number)
+			continue;
+		fmt::print("Using mapper {} ({})\n", number, board.name);
+		return board.create(mapper, prg, prgSize);
+	}
+	throw std::runtime_error(fmt::format("Mapper {} is not supported", number));
+}
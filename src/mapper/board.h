@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include "mapper/memorymapper.h"
+#include "mapper/storehandler.h"
+
+// The cartridge hardware between the CPU and the PRG ROM. Decides which part
+// of the ROM shows up where, and switches banks when the program stores to
+// its registers.
+// @COMPLETENESS: There is no PPU, so CHR banks, mirroring control and
+// scanline IRQs are only kept track of, nothing acts on them.
+class Board : public StoreHandler {
+	protected:
+		MemoryMapper& mapper;
+		// All of the PRG ROM as a single bank
+		std::shared_ptr<MemoryBank> prg;
+		size_t prgSize;
+
+		// Map the size byte PRG bank number bank at addr. Negative numbers
+		// count from the end, so -1 is the last bank. Bank numbers wrap
+		// around like the missing address lines would make them.
+		void mapPrg(uint16_t addr, size_t size, int32_t bank, bool switchable);
+	public:
+		Board(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize);
+		virtual ~Board();
+
+		// Map what the board maps at power on
+		virtual void reset() = 0;
+};
+
+// Create the board for an iNES mapper number. Throws a runtime_error for the
+// ones we don't have.
+std::unique_ptr<Board> createBoard(uint16_t number, MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize);
@@ -0,0 +1,170 @@
+#include "mapper/boards.h"
+
+void Nrom::reset() {
+	mapPrg(0x8000, 0x8000, 0, false);
+}
+
+void Nrom::stored(uint16_t addr, uint8_t value) {
+	// Nothing to switch
+}
+
+Mmc1::Mmc1(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize) :
+	Board(mapper, prg, prgSize),
+	shift(0),
+	shiftCount(0),
+	control(0x0C),
+	chrBanks(),
+	prgBank(0) {
+	mapper.setHandler(0x80, 0x80, this);
+}
+
+void Mmc1::reset() {
+	shift = 0;
+	shiftCount = 0;
+	// Starts out with the last bank fixed at 0xC000
+	control = 0x0C;
+	prgBank = 0;
+	update();
+}
+
+void Mmc1::update() {
+	// The program can change the mode, so every window is switchable
+	uint8_t bank = prgBank & 0x0F;
+	switch((control >> 2) & 0x03) {
+		case 0:
+		case 1:
+			mapPrg(0x8000, 0x8000, bank >> 1, true);
+			break;
+		case 2:
+			mapPrg(0x8000, 0x4000, 0, true);
+			mapPrg(0xC000, 0x4000, bank, true);
+			break;
+		case 3:
+			mapPrg(0x8000, 0x4000, bank, true);
+			mapPrg(0xC000, 0x4000, -1, true);
+			break;
+	}
+}
+
+void Mmc1::stored(uint16_t addr, uint8_t value) {
+	if(value & 0x80) {
+		shift = 0;
+		shiftCount = 0;
+		control |= 0x0C;
+		update();
+		return;
+	}
+
+	shift |= (value & 1) << shiftCount;
+	if(++shiftCount < 5)
+		return;
+
+	// The fifth store picks the register by its address
+	switch((addr >> 13) & 0x03) {
+		case 0:
+			control = shift;
+			break;
+		case 1:
+			chrBanks[0] = shift;
+			break;
+		case 2:
+			chrBanks[1] = shift;
+			break;
+		case 3:
+			prgBank = shift;
+			break;
+	}
+	shift = 0;
+	shiftCount = 0;
+	update();
+}
+
+Uxrom::Uxrom(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize) :
+	Board(mapper, prg, prgSize) {
+	mapper.setHandler(0x80, 0x80, this);
+}
+
+void Uxrom::reset() {
+	mapPrg(0x8000, 0x4000, 0, true);
+	mapPrg(0xC000, 0x4000, -1, false);
+}
+
+void Uxrom::stored(uint16_t addr, uint8_t value) {
+	mapPrg(0x8000, 0x4000, value, true);
+}
+
+Cnrom::Cnrom(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize) :
+	Board(mapper, prg, prgSize),
+	chrBank(0) {
+	mapper.setHandler(0x80, 0x80, this);
+}
+
+void Cnrom::reset() {
+	mapPrg(0x8000, 0x8000, 0, false);
+	chrBank = 0;
+}
+
+void Cnrom::stored(uint16_t addr, uint8_t value) {
+	chrBank = value;
+}
+
+Mmc3::Mmc3(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize) :
+	Board(mapper, prg, prgSize),
+	select(0),
+	registers(),
+	mirroring(0),
+	ramProtect(0),
+	irqLatch(0),
+	irqReload(false),
+	irqEnabled(false) {
+	mapper.setHandler(0x80, 0x80, this);
+}
+
+void Mmc3::reset() {
+	select = 0;
+	// Whatever the power on state is, the fixed banks are the same
+	registers[6] = 0;
+	registers[7] = 1;
+	update();
+}
+
+void Mmc3::update() {
+	// Bit 6 of the select register swaps 0x8000 and 0xC000
+	bool swapped = select & 0x40;
+	mapPrg(swapped ? 0xC000 : 0x8000, 0x2000, registers[6] & 0x3F, true);
+	mapPrg(0xA000, 0x2000, registers[7] & 0x3F, true);
+	mapPrg(swapped ? 0x8000 : 0xC000, 0x2000, -2, true);
+	mapPrg(0xE000, 0x2000, -1, false);
+}
+
+void Mmc3::stored(uint16_t addr, uint8_t value) {
+	// Each register shows up at every even or odd address of its 8K
+	switch(addr & 0xE001) {
+		case 0x8000:
+			select = value;
+			update();
+			break;
+		case 0x8001:
+			registers[select & 0x07] = value;
+			update();
+			break;
+		case 0xA000:
+			mirroring = value & 1;
+			break;
+		case 0xA001:
+			ramProtect = value;
+			break;
+		case 0xC000:
+			irqLatch = value;
+			break;
+		case 0xC001:
+			irqReload = true;
+			break;
+		case 0xE000:
+			irqEnabled = false;
+			break;
+		case 0xE001:
+			irqEnabled = true;
+			break;
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "mapper/board.h"
+
+// Mapper 0. 16K or 32K of PRG ROM and nothing to switch.
+class Nrom : public Board {
+	public:
+		using Board::Board;
+
+		void reset();
+		void stored(uint16_t addr, uint8_t value);
+};
+
+// Mapper 1. Registers are loaded a bit at a time through a serial port, and
+// switch either 32K at once or one of the two 16K halves.
+// @COMPLETENESS: The 512K boards that take a PRG bit from the CHR registers,
+// and the way the real chip ignores the second store of a read-modify-write,
+// aren't handled.
+class Mmc1 : public Board {
+	private:
+		uint8_t shift;
+		uint8_t shiftCount;
+		uint8_t control;
+		uint8_t chrBanks[2];
+		uint8_t prgBank;
+
+		void update();
+	public:
+		Mmc1(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize);
+
+		void reset();
+		void stored(uint16_t addr, uint8_t value);
+};
+
+// Mapper 2. Any store switches the 16K at 0x8000, the last bank is fixed at
+// 0xC000.
+// @COMPLETENESS: Bus conflicts aren't emulated.
+class Uxrom : public Board {
+	public:
+		Uxrom(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize);
+
+		void reset();
+		void stored(uint16_t addr, uint8_t value);
+};
+
+// Mapper 3. Fixed PRG like NROM, stores switch the 8K of CHR.
+class Cnrom : public Board {
+	private:
+		uint8_t chrBank;
+	public:
+		Cnrom(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize);
+
+		void reset();
+		void stored(uint16_t addr, uint8_t value);
+};
+
+// Mapper 4. Two switchable 8K banks, one of which can trade places with the
+// fixed second to last bank, and the last bank fixed at 0xE000.
+// @COMPLETENESS: The IRQ counter is clocked by the PPU, so it never fires.
+class Mmc3 : public Board {
+	private:
+		uint8_t select;
+		uint8_t registers[8];
+		uint8_t mirroring;
+		uint8_t ramProtect;
+		uint8_t irqLatch;
+		bool irqReload;
+		bool irqEnabled;
+
+		void update();
+	public:
+		Mmc3(MemoryMapper& mapper, std::shared_ptr<MemoryBank> prg, size_t prgSize);
+
+		void reset();
+		void stored(uint16_t addr, uint8_t value);
+};
@@ -0,0 +1,98 @@
+#include "mapper/fastmem.h"
+
+#include <signal.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#define SPACE_SIZE 0x10000
+#define CHUNK_SIZE 0x1000
+
+// Only one mapper runs generated code, so only one of these can fault
+static FastMem* instance = nullptr;
+
+static void handleFault(int sig, siginfo_t* info, void* context) {
+	auto uc = (ucontext_t*)context;
+	uint8_t* rip = (uint8_t*)uc->uc_mcontext.gregs[REG_RIP];
+	uintptr_t addr = (uintptr_t)info->si_addr;
+
+	// movzx ecx, byte [rax + disp32] into the view. Anything else is a real
+	// crash.
+	if(instance != nullptr && addr - instance->getBase() < SPACE_SIZE
+			&& rip[0] == 0x0F && rip[1] == 0xB6 && rip[2] == 0x88) {
+		uc->uc_mcontext.gregs[REG_RIP] += FastMem::FAULT_SKIP;
+		return;
+	}
+
+	signal(SIGSEGV, SIG_DFL);
+}
+
+FastMem::FastMem() : fast(), readable() {
+	fd = memfd_create("fastmem", 0);
+	if(fd < 0 || ftruncate(fd, SPACE_SIZE) != 0)
+		throw std::runtime_error("Could not create the fastmem backing");
+
+	view = (uint8_t*)mmap(nullptr, SPACE_SIZE, PROT_NONE, MAP_SHARED | MAP_32BIT, fd, 0);
+	shadow = (uint8_t*)mmap(nullptr, SPACE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(view == MAP_FAILED || shadow == MAP_FAILED)
+		throw std::runtime_error("Could not map the fastmem region");
+	// The base is a signed 32 bit displacement in the generated code
+	if((uintptr_t)view >= 0x80000000 - SPACE_SIZE)
+		throw std::runtime_error("The fastmem region didn't end up in the low 2GB");
+
+	instance = this;
+	struct sigaction action = {};
+	action.sa_sigaction = handleFault;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, nullptr);
+
+	fmt::print("Fastmem region at {}\n", (void*)view);
+}
+
+FastMem::~FastMem() {
+	signal(SIGSEGV, SIG_DFL);
+	instance = nullptr;
+	munmap(view, SPACE_SIZE);
+	munmap(shadow, SPACE_SIZE);
+	close(fd);
+}
+
+uintptr_t FastMem::getBase() {
+	return (uintptr_t)view;
+}
+
+uint8_t* FastMem::getShared(uint8_t page) {
+	return shadow + (page << 8);
+}
+
+void FastMem::update(uint8_t page, uint8_t* data) {
+	fast[page] = data != nullptr;
+	if(data != nullptr && data != getShared(page))
+		memcpy(getShared(page), data, 0x100);
+
+	uint8_t chunk = page >> 4;
+	bool any = false;
+	for(int i = 0; i < 0x10; i++)
+		any |= fast[chunk * 0x10 + i];
+	if(any != readable[chunk]) {
+		mprotect(view + chunk * CHUNK_SIZE, CHUNK_SIZE, any ? PROT_READ : PROT_NONE);
+		readable[chunk] = any;
+	}
+}
+
+bool FastMem::isReadable(uint16_t start, uint16_t end) {
+	// The range may wrap around the end of the address space
+	uint8_t page = start >> 8;
+	while(true) {
+		if(!fast[page])
+			return false;
+		if(page == (end >> 8))
+			return true;
+		page++;
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+// A 1:1 image of the fixed parts of the guest address space. It lives in the
+// low 2GB, so generated code can read a guest byte with a single mov using the
+// base as the displacement. 4K chunks without anything in them are PROT_NONE,
+// and the loads that hit them are sent to their slow path by a SIGSEGV
+// handler.
+//
+// The image is written through a second mapping of the same memory. RAM can
+// be moved into it with getShared, after which the view shows it as it is
+// stored to. Fixed ROM pages are copied in when they are mapped. Switchable
+// pages are never in the image, switching a bank must not cost a copy.
+//
+// Only pages marked fast show what is mapped there. The others can still be
+// in a readable chunk, so compiled code must only take the fast path for
+// ranges isReadable agreed to, and those have to stay mapped like that.
+class FastMem {
+	private:
+		int fd;
+		uint8_t* view;
+		uint8_t* shadow;
+		// Per guest page, whether view shows it
+		bool fast[0x100];
+		// Per 4K host page, whether view can be read there
+		bool readable[0x10];
+	public:
+		// Size of the code emitted by emitLoad up to its slow path
+		static const int FAULT_SKIP = 9;
+
+		FastMem();
+		~FastMem();
+
+		uintptr_t getBase();
+		// Host memory the view shows at the guest page. Memory moved here
+		// is seen by the view without any copying.
+		uint8_t* getShared(uint8_t page);
+		// Show data at the guest page. It is copied unless it is
+		// getShared(page) already, null takes the page out of the view.
+		void update(uint8_t page, uint8_t* data);
+		bool isReadable(uint16_t start, uint16_t end);
+};
@@ -1,34 +1,72 @@
 #include "mapper/filememorybank.h"
 
-#include <fstream>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-ReadingMemoryBank::ReadingMemoryBank(std::ifstream &fs, size_t size) :
-	m_memory(std::shared_ptr<char>(new char[size])),
+ReadingMemoryBank::ReadingMemoryBank(const std::string& path, size_t offset, size_t size, bool copyOnWrite) :
 	size(size) {
-	//@SPEED: This is slow and could be replaced with a mmap
-	fs.read(m_memory.get(), size);
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("Could not open " + path);
+
+	// mmap wants a page aligned offset
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t aligned = offset & ~(pageSize - 1);
+	mappingSize = size + (offset - aligned);
+
+	// Touching a mapping past the end of the file is a SIGBUS, so a short
+	// file has to be caught here
+	struct stat st;
+	if(fstat(fd, &st) < 0 || aligned + mappingSize > (size_t)st.st_size) {
+		close(fd);
+		throw std::runtime_error(path + " is shorter than its header says");
+	}
+
+	int prot = copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+	int flags = copyOnWrite ? MAP_PRIVATE : MAP_SHARED;
+	mapping = mmap(nullptr, mappingSize, prot, flags, fd, aligned);
+	// The mapping keeps the file alive
+	close(fd);
+	if(mapping == MAP_FAILED)
+		throw std::runtime_error("Could not map " + path);
+
+	m_memory = (uint8_t*)mapping + (offset - aligned);
+}
+
+ReadingMemoryBank::~ReadingMemoryBank() {
+	munmap(mapping, mappingSize);
 }
 
 uint8_t ReadingMemoryBank::getValue(size_t addr) {
-	return m_memory.get()[addr];
+	return m_memory[addr];
 }
 
 void ReadingMemoryBank::setValue(size_t addr, uint8_t value) {
-	m_memory.get()[addr] = value;
+	// Writing to ROM does nothing
 }
 
 uint16_t ReadingMemoryBank::getSize() {
 	return size >> 8;
 }
 
+bool ReadingMemoryBank::isWritable() {
+	// This is ROM as far as the guest is concerned
+	return false;
+}
+
+uint8_t* ReadingMemoryBank::getMemory() {
+	return this->m_memory;
+}
+
 void ReadingMemoryBank::emitLoad(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp dest) {
 	auto temp = asmjit::x86::rax;
-	a.mov(temp, (uint64_t)this->m_memory.get() + addr);
+	a.mov(temp, (uint64_t)this->m_memory + addr);
 	a.mov(dest, asmjit::x86::byte_ptr(temp));
 }
 
 void ReadingMemoryBank::emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src) {
-	auto temp = asmjit::x86::rax;
-	a.mov(temp, (uint64_t)this->m_memory.get() + addr);
-	a.mov(asmjit::x86::byte_ptr(temp), src);
+	// Writing to ROM does nothing
 }
@@ -1,18 +1,29 @@
 #pragma once
 
 #include <memory>
-#include <iostream>
+#include <string>
 
 #include "mapper/memorybank.h"
 
+// ROM straight out of a file. The file is mapped rather than read, so loading
+// costs nothing up front and every process running the same game shares the
+// pages.
 class ReadingMemoryBank : public MemoryBank {
 	private:
-		std::shared_ptr<char> m_memory;
+		void* mapping;
+		size_t mappingSize;
+		uint8_t* m_memory;
 		size_t size;
 	public:
-		ReadingMemoryBank(std::ifstream &fs, size_t size);
+		// Map size bytes of the file at path starting at offset. With
+		// copyOnWrite the host can patch the ROM through getMemory without
+		// touching the file, otherwise the memory is read only.
+		ReadingMemoryBank(const std::string& path, size_t offset, size_t size, bool copyOnWrite = false);
+		~ReadingMemoryBank();
 
 		uint16_t getSize();
+		bool isWritable();
+		uint8_t* getMemory();
 
 		uint8_t getValue(size_t addr);
 		void setValue(size_t addr, uint8_t value);
@@ -20,4 +31,3 @@ class ReadingMemoryBank : public MemoryBank {
 		void emitLoad(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp dest);
 		void emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src);
 };
-
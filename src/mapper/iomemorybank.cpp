@@ -0,0 +1,40 @@
+#include "mapper/iomemorybank.h"
+
+IoMemoryBank::IoMemoryBank(size_t count, size_t size) :
+	registers(new uint8_t[count]()),
+	count(count),
+	size(size) {
+}
+
+uint8_t IoMemoryBank::getValue(size_t addr) {
+	return registers[addr % count];
+}
+
+void IoMemoryBank::setValue(size_t addr, uint8_t value) {
+	registers[addr % count] = value;
+}
+
+uint16_t IoMemoryBank::getSize() {
+	return size >> 8;
+}
+
+bool IoMemoryBank::isWritable() {
+	return true;
+}
+
+uint8_t* IoMemoryBank::getMemory() {
+	// Every access has to go through the registers
+	return nullptr;
+}
+
+void IoMemoryBank::emitLoad(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp dest) {
+	auto temp = asmjit::x86::rax;
+	a.mov(temp, (uint64_t)&this->registers[addr % count]);
+	a.mov(dest, asmjit::x86::byte_ptr(temp));
+}
+
+void IoMemoryBank::emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src) {
+	auto temp = asmjit::x86::rax;
+	a.mov(temp, (uint64_t)&this->registers[addr % count]);
+	a.mov(asmjit::x86::byte_ptr(temp), src);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+
+#include "mapper/memorybank.h"
+
+// Memory mapped registers. There are only count of them, repeated over and
+// over through the size of the bank, like the PPU registers from 0x2000 to
+// 0x3FFF.
+// @COMPLETENESS: Nothing is behind the registers yet, they just hold whatever
+// was last written to them.
+class IoMemoryBank : public MemoryBank {
+	private:
+		std::unique_ptr<uint8_t[]> registers;
+		size_t count;
+		size_t size;
+
+	public:
+		IoMemoryBank(size_t count, size_t size);
+
+		uint16_t getSize();
+		bool isWritable();
+		uint8_t* getMemory();
+
+		uint8_t getValue(size_t addr);
+		void setValue(size_t addr, uint8_t value);
+
+		void emitLoad(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp dest);
+		void emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src);
+};
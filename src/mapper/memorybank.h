@@ -14,6 +14,14 @@ class MemoryBank {
 		virtual void emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src) = 0;
 
 		virtual uint16_t getSize() = 0;
+		// Whether guest stores can change what is read back from this bank
+		virtual bool isWritable() = 0;
+		// Host memory backing the bank, or null if every access has to go
+		// through getValue and setValue
+		virtual uint8_t* getMemory() = 0;
+		// Move the contents to memory, which the bank uses from then on.
+		// Returns false for banks that can't be moved.
+		virtual bool relocate(uint8_t* memory) { return false; };
 
 		virtual ~MemoryBank() {};
 
@@ -1,67 +1,360 @@
 #include "mapper/memorymapper.h"
 
+#include <algorithm>
+
 #include <fmt/format.h>
 
+#include "hostregs.h"
+#include "registers.h"
+
 #define BANK_SIZE 0x4000
 
+MemoryMapper::MemoryMapper() : pages(), switchable(), handlers(), watched(), reported(), watchers(), readPages(), writePages(), watcher(nullptr) {
+	for(uint16_t page = 0; page < 0x100; page++)
+		aliases[page] = page;
+}
+
+void MemoryMapper::setWatcher(WriteWatcher* watcher) {
+	this->watcher = watcher;
+}
+
+bool MemoryMapper::watch(uint8_t page, bool enable) {
+	if(pages[page].bank == nullptr || !pages[page].writable)
+		return false;
+	if(watched[page] != enable) {
+		watched[page] = enable;
+		// Only the aliases of the page change, this runs for every block
+		// that is inserted or dropped
+		countWatch(page, enable ? 1 : -1);
+	}
+	return true;
+}
+
+void MemoryMapper::countWatch(uint8_t page, int delta) {
+	forEachAlias(page, [&](uint8_t alias) {
+		watchers[alias] += delta;
+		bool report = watchers[alias] != 0;
+		if(report != (reported[alias] != 0)) {
+			reported[alias] = report;
+			updatePage(alias);
+		}
+	});
+}
+
+template<class F>
+void MemoryMapper::forEachAlias(uint8_t page, F f) {
+	uint8_t alias = page;
+	do {
+		f(alias);
+		alias = aliases[alias];
+	} while(alias != page);
+}
+
+void MemoryMapper::updateAliases() {
+	// Sorted on the memory they show, so aliases end up next to each other
+	uint8_t order[0x100];
+	uint16_t count = 0;
+	for(uint16_t page = 0; page < 0x100; page++) {
+		aliases[page] = page;
+		if(pages[page].bank != nullptr && pages[page].writable)
+			order[count++] = page;
+	}
+	std::sort(order, order + count, [&](uint8_t a, uint8_t b) {
+		if(pages[a].bank != pages[b].bank)
+			return std::less<MemoryBank*>()(pages[a].bank, pages[b].bank);
+		if(pages[a].offset != pages[b].offset)
+			return pages[a].offset < pages[b].offset;
+		return a < b;
+	});
+
+	// Close every run of them into a ring
+	uint16_t first = 0;
+	for(uint16_t i = 1; i <= count; i++) {
+		if(i < count && getSource(order[i]) == getSource(order[first])) {
+			aliases[order[i - 1]] = order[i];
+			continue;
+		}
+		aliases[order[i - 1]] = order[first];
+		first = i;
+	}
+}
+
+void MemoryMapper::updateReported() {
+	for(uint16_t page = 0; page < 0x100; page++) {
+		reported[page] = false;
+		watchers[page] = 0;
+	}
+	for(uint16_t page = 0; page < 0x100; page++) {
+		if(watched[page])
+			countWatch(page, 1);
+	}
+	for(uint16_t page = 0; page < 0x100; page++)
+		updatePage(page);
+}
+
+void MemoryMapper::written(uint16_t addr) {
+	if(!reported[addr >> 8] || watcher == nullptr)
+		return;
+	// The code might have been decoded from any of the mirrors
+	forEachAlias(addr >> 8, [&](uint8_t alias) {
+		if(watched[alias])
+			watcher->written((alias << 8) | (addr & 0xFF));
+	});
+}
+
 void MemoryMapper::setBank(uint8_t startPage, std::shared_ptr<MemoryBank> bank) {
 	uint8_t endPage = startPage + bank->getSize()-1;
 	fmt::print("Adding bank starting at 0x{:X} and ending at 0x{:X}\n", startPage, endPage);
+	map(startPage, bank->getSize(), bank, 0, false);
+}
+
+void MemoryMapper::map(uint8_t startPage, uint16_t count, std::shared_ptr<MemoryBank> bank, size_t offset, bool switchable) {
+	uint8_t* memory = bank->getMemory();
+	bool changed = false;
+	// Whether stores to any of the pages have to be reported, before or after
+	bool watchable = bank->isWritable();
+	// Whether writable memory comes or goes, which is all aliases are kept for
+	bool relinked = bank->isWritable();
 	// Use a 16 bit variable to avoid overflow
-	for(uint16_t i = startPage; i <= endPage; i++) {
-		pageTable[i] = bank;
+	for(uint16_t i = 0; i < count; i++) {
+		uint8_t page = startPage + i;
+		size_t pageOffset = offset + (i << 8);
+		bool wasSwitchable = this->switchable[page];
+		this->switchable[page] = switchable;
+		// Boards like to write the same bank register over and over
+		bool same = pages[page].bank == bank.get() && pages[page].offset == pageOffset;
+		if(!same) {
+			changed = true;
+			watchable |= reported[page];
+			relinked |= pages[page].writable;
+			owners[page] = bank;
+			pages[page] = {
+				bank.get(),
+				(uint32_t)pageOffset,
+				memory != nullptr ? memory + pageOffset : nullptr,
+				bank->isWritable(),
+			};
+		}
+		// Switchable pages stay out of the fastmem image, so a bank switch
+		// doesn't copy anything there
+		if(fastmem != nullptr && !(wasSwitchable && switchable) && (!same || wasSwitchable != switchable))
+			updateFastMem(page);
+	}
+	if(!changed)
+		return;
+	if(relinked)
+		updateAliases();
+
+	// Only writable memory can be watched, so switching between ROM banks
+	// leaves the rest of the page table alone
+	if(watchable) {
+		updateReported();
+	} else {
+		for(uint16_t i = 0; i < count; i++)
+			updatePage(startPage + i);
+	}
+	if(watcher != nullptr)
+		watcher->mapped(startPage, count);
+}
+
+void MemoryMapper::mirror(uint8_t startPage, uint16_t count, uint8_t source, uint16_t sourceCount) {
+	fmt::print("Mirroring 0x{:X} pages from 0x{:X} at 0x{:X}\n", sourceCount, source, startPage);
+	for(uint16_t i = 0; i < count; i++) {
+		uint8_t page = startPage + i;
+		uint8_t from = source + i % sourceCount;
+		pages[page] = pages[from];
+		owners[page] = owners[from];
+		switchable[page] = switchable[from];
 	}
+	updateAliases();
+	updateReported();
+	if(fastmem != nullptr) {
+		for(uint16_t i = 0; i < count; i++)
+			updateFastMem(startPage + i);
+	}
+	if(watcher != nullptr)
+		watcher->mapped(startPage, count);
+}
+
+void MemoryMapper::setHandler(uint8_t startPage, uint16_t count, StoreHandler* handler) {
+	for(uint16_t i = 0; i < count; i++) {
+		uint8_t page = startPage + i;
+		handlers[page] = handler;
+		updatePage(page);
+	}
+}
+
+PageSource MemoryMapper::getSource(uint8_t page) {
+	return {pages[page].bank, pages[page].offset};
 }
 
-std::shared_ptr<MemoryBank> MemoryMapper::getBank(uint16_t addr, uint16_t& relAddr) {
-	// @HACK: Find the first page mapped to this bank. This should be
-	// reconsidered
-	uint8_t page = (addr >> 8);
-	auto pageEntry = pageTable[page];
-	for(uint16_t i = page; i > 0; i--) {
-		auto thisEntry = pageTable[i-1];
-		if(thisEntry != pageEntry) {
-			page = i;
-			break;
+uintptr_t* MemoryMapper::getReadPages() {
+	return readPages;
+}
+
+uintptr_t* MemoryMapper::getWritePages() {
+	return writePages;
+}
+
+bool MemoryMapper::isSwitchable(uint8_t page) {
+	return switchable[page];
+}
+
+void MemoryMapper::enableFastMem() {
+	fastmem = std::make_unique<FastMem>();
+
+	// Fixed RAM moves into the image, at the place it is first mapped. Its
+	// mirrors can't be shown at host page granularity and stay slow.
+	for(uint16_t page = 0; page < 0x100; page++) {
+		MemoryBank* bank = pages[page].bank;
+		if(bank == nullptr || !pages[page].writable || pages[page].data == nullptr)
+			continue;
+		if(pages[page].offset != 0 || switchable[page])
+			continue;
+		uint16_t size = bank->getSize();
+		if(page + size > 0x100 || !bank->relocate(fastmem->getShared(page)))
+			continue;
+		for(uint16_t other = 0; other < 0x100; other++) {
+			if(pages[other].bank == bank)
+				pages[other].data = bank->getMemory() + pages[other].offset;
 		}
+		page += size - 1;
+	}
+
+	for(uint16_t page = 0; page < 0x100; page++) {
+		updatePage(page);
+		updateFastMem(page);
+	}
+}
+
+void MemoryMapper::updateFastMem(uint8_t page) {
+	auto& entry = pages[page];
+	uint8_t* data = nullptr;
+	if(!switchable[page] && entry.data != nullptr) {
+		// RAM that lives in the image is shown as it is. Anything else
+		// writable would go stale in a copy.
+		if(entry.data == fastmem->getShared(page) || !entry.writable)
+			data = entry.data;
+	}
+	fastmem->update(page, data);
+}
+
+bool MemoryMapper::isFast(uint16_t start, uint16_t end) {
+	return fastmem != nullptr && fastmem->isReadable(start, end);
+}
+
+void MemoryMapper::updatePage(uint8_t page) {
+	auto& entry = pages[page];
+	if(entry.data == nullptr) {
+		readPages[page] = 0;
+		writePages[page] = 0;
+		return;
 	}
-	relAddr = addr - (page << 8);
-	return pageEntry;
+
+	// Offset so the full guest address can be added to it
+	uintptr_t base = (uintptr_t)entry.data - (page << 8);
+	readPages[page] = base;
+	writePages[page] = entry.writable && !reported[page] && handlers[page] == nullptr ? base : 0;
 }
 
 uint8_t MemoryMapper::getValue(size_t addr) {
-	uint16_t relAddr;
-	return getBank(addr, relAddr)->getValue(relAddr);
+	auto& page = pages[(addr >> 8) & 0xFF];
+	if(page.data != nullptr)
+		return page.data[addr & 0xFF];
+	return page.bank->getValue(page.offset + (addr & 0xFF));
 }
 
 void MemoryMapper::setValue(size_t addr, uint8_t value) {
-	uint16_t relAddr;
-	return getBank(addr, relAddr)->setValue(relAddr, value);
+	auto& page = pages[(addr >> 8) & 0xFF];
+	if(page.data != nullptr && page.writable)
+		page.data[addr & 0xFF] = value;
+	else
+		page.bank->setValue(page.offset + (addr & 0xFF), value);
+	written(addr);
+
+	StoreHandler* handler = handlers[(addr >> 8) & 0xFF];
+	if(handler != nullptr)
+		handler->stored(addr, value);
 }
 
 void MemoryMapper::emitLoad(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp dest) {
-	uint16_t relAddr;
-	auto bank = getBank(addr, relAddr);
-	bank->emitLoad(a, relAddr, dest);
-}
+	// Whatever is mapped here now might not be when the code runs
+	if(switchable[addr >> 8]) {
+		a.mov(asmjit::x86::eax, addr);
+		emitDynamicLoad(a, asmjit::x86::rax, dest);
+		return;
+	}
 
-void MemoryMapper::emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src) {
-	uint16_t relAddr;
-	auto bank = getBank(addr, relAddr);
-	bank->emitStore(a, relAddr, src);
+	auto& page = pages[addr >> 8];
+	// Bank offsets of big ROMs don't fit what the banks take
+	if(page.data != nullptr) {
+		a.mov(asmjit::x86::rax, (uint64_t)(page.data + (addr & 0xFF)));
+		a.mov(dest, asmjit::x86::byte_ptr(asmjit::x86::rax));
+		return;
+	}
+	page.bank->emitLoad(a, page.offset + (addr & 0xFF), dest);
 }
 
 static uint8_t getHelper(MemoryMapper* mapper, uint16_t addr) {
 	return mapper->getValue(addr);
 }
+static void writtenHelper(MemoryMapper* mapper, uint16_t addr) {
+	mapper->written(addr);
+}
+
+void MemoryMapper::emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src) {
+	// The page tables know what is mapped when the code runs, and send
+	// stores a board has to see to setValue
+	if(switchable[addr >> 8] || handlers[addr >> 8] != nullptr) {
+		a.mov(asmjit::x86::eax, addr);
+		emitDynamicStore(a, asmjit::x86::rax, src);
+		return;
+	}
+
+	auto& page = pages[addr >> 8];
+	page.bank->emitStore(a, page.offset + (addr & 0xFF), src);
+
+	if(!page.writable)
+		return;
+
+	// The page might get code compiled into it later, so the check has to
+	// happen at runtime
+	auto NotWatched = a.newLabel();
+	a.mov(asmjit::x86::rax, (uint64_t)&this->reported[addr >> 8]);
+	a.cmp(asmjit::x86::byte_ptr(asmjit::x86::rax), 0);
+	a.je(NotWatched);
+
+	a.mov(asmjit::x86::rdi, (uint64_t)this);
+	a.mov(asmjit::x86::esi, addr);
+	a.call((uint64_t)&writtenHelper);
+
+	a.bind(NotWatched);
+}
 static void setHelper(MemoryMapper* mapper, uint16_t addr, uint8_t value) {
 	mapper->setValue(addr, value);
 }
 
+// Look up the host base of the page addr is in, in the page table at offset
+// table of the CpuContext. Leaves it in rdx and jumps to slow if there is
+// none. Only touches rdx and rsi.
+static void emitPageLookup(asmjit::X86Assembler& a, int32_t table, asmjit::X86Gp addr, asmjit::Label slow) {
+	a.movzx(asmjit::x86::esi, addr.r16());
+	a.shr(asmjit::x86::esi, 8);
+	a.mov(asmjit::x86::rdx, asmjit::x86::qword_ptr(REG_CTX, table));
+	a.mov(asmjit::x86::rdx, asmjit::x86::qword_ptr(asmjit::x86::rdx, asmjit::x86::rsi, 3));
+	a.test(asmjit::x86::rdx, asmjit::x86::rdx);
+	a.jz(slow);
+}
+
 void MemoryMapper::emitDynamicLoad(asmjit::X86Assembler& a, asmjit::X86Gp addr, asmjit::X86Gp dest) {
-	a.push(asmjit::x86::r10);
-	a.push(asmjit::x86::r11);
-	/* a.sub(asmjit::x86::rsp, 8); // Align stack pointer to 16 byte boundry */
+	auto Slow = a.newLabel();
+	auto Done = a.newLabel();
+
+	emitPageLookup(a, offsetof(CpuContext, readPages), addr, Slow);
+	a.mov(dest, asmjit::x86::byte_ptr(asmjit::x86::rdx, addr));
+	a.jmp(Done);
+
+	a.bind(Slow);
 
 	// First param
 	a.mov(asmjit::x86::rdi, (uint64_t)this);
@@ -69,19 +362,39 @@ void MemoryMapper::emitDynamicLoad(asmjit::X86Assembler& a, asmjit::X86Gp addr,
 	a.mov(asmjit::x86::rsi, addr);
 	a.call((uint64_t)&getHelper);
 
-	/* a.add(asmjit::x86::rsp, 8); */
-	a.pop(asmjit::x86::r11);
-	a.pop(asmjit::x86::r10);
-
 	// Move return value into dest register
 	a.mov(dest, asmjit::x86::al);
+	a.bind(Done);
+}
+
+void MemoryMapper::emitFastLoad(asmjit::X86Assembler& a, asmjit::X86Gp addr, asmjit::X86Gp dest) {
+	auto Done = a.newLabel();
+
+	// The fault handler knows this exact encoding, and skips FastMem::FAULT_SKIP
+	// bytes to land on the slow path
+	a.movzx(asmjit::x86::ecx, asmjit::x86::byte_ptr(addr, (int32_t)fastmem->getBase()));
+	a.short_().jmp(Done);
+
+	a.mov(asmjit::x86::rdi, (uint64_t)this);
+	a.mov(asmjit::x86::rsi, addr);
+	a.call((uint64_t)&getHelper);
+	a.mov(asmjit::x86::ecx, asmjit::x86::eax);
+
+	a.bind(Done);
+	a.mov(dest, asmjit::x86::cl);
 }
 
 template <class T>
 void MemoryMapper::emitDynamicStore(asmjit::X86Assembler& a, asmjit::X86Gp addr, T src) {
-	a.push(asmjit::x86::r10);
-	a.push(asmjit::x86::r11);
-	/* a.sub(asmjit::x86::rsp, 8); // Align stack pointer to 16 byte boundry */
+	auto Slow = a.newLabel();
+	auto Done = a.newLabel();
+
+	// Watched pages have no entry, so their stores get reported by setValue
+	emitPageLookup(a, offsetof(CpuContext, writePages), addr, Slow);
+	a.mov(asmjit::x86::byte_ptr(asmjit::x86::rdx, addr), src);
+	a.jmp(Done);
+
+	a.bind(Slow);
 
 	// First param
 	a.mov(asmjit::x86::rdi, (uint64_t)this);
@@ -91,9 +404,7 @@ void MemoryMapper::emitDynamicStore(asmjit::X86Assembler& a, asmjit::X86Gp addr,
 	a.mov(asmjit::x86::dl, src);
 	a.call((uint64_t)&setHelper);
 
-	/* a.add(asmjit::x86::rsp, 8); */
-	a.pop(asmjit::x86::r11);
-	a.pop(asmjit::x86::r10);
+	a.bind(Done);
 }
 
 template void MemoryMapper::emitDynamicStore(asmjit::X86Assembler&, asmjit::X86Gp, uint8_t);
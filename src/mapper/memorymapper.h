@@ -6,21 +6,126 @@
 #include <asmjit/asmjit.h>
 #include <fmt/format.h>
 
+#include "mapper/fastmem.h"
 #include "mapper/memorybank.h"
+#include "mapper/storehandler.h"
+#include "mapper/writewatcher.h"
+
+// The bank memory a guest page shows. Code decoded from a page is only valid
+// while the page still shows the same memory.
+struct PageSource {
+	MemoryBank* bank;
+	uint32_t offset;
+
+	bool operator==(const PageSource& other) const {
+		return bank == other.bank && offset == other.offset;
+	}
+};
 
 class MemoryMapper {
 	private:
-		std::shared_ptr<MemoryBank> pageTable[0xFF];
+		// Everything about a 256 byte guest page an access needs, worked out
+		// when the bank is mapped
+		struct Page {
+			MemoryBank* bank;
+			// Where the page starts within the bank
+			uint32_t offset;
+			// Host memory of the page, or null if accesses have to go through
+			// the bank
+			uint8_t* data;
+			bool writable;
+		};
+		Page pages[0x100];
+		// Keeps the mapped banks alive
+		std::shared_ptr<MemoryBank> owners[0x100];
+		// Pages a board can map something else into at any time. Generated
+		// code can't bake in what is there when it is compiled.
+		uint8_t switchable[0x100];
+		// Gets the stores to each page, if anything
+		StoreHandler* handlers[0x100];
 
-		std::shared_ptr<MemoryBank> getBank(uint16_t addr, uint16_t& relAddr);
+		// Pages the watcher asked about
+		uint8_t watched[0x100];
+		// Non zero for pages where stores have to be reported to the watcher,
+		// which is any page sharing memory with a watched one
+		uint8_t reported[0x100];
+		// Number of watched pages sharing memory with each page, which
+		// reported is worked out from
+		uint16_t watchers[0x100];
+		// The next page showing the same memory, going round in a ring. Only
+		// writable pages are linked up, nothing else can be watched.
+		uint8_t aliases[0x100];
+		// What generated code indexes with a full guest address to get at
+		// the host byte directly, through the CpuContext. Zero for pages that need the helpers, like
+		// ROM and watched pages for stores, or banks without host memory.
+		uintptr_t readPages[0x100];
+		uintptr_t writePages[0x100];
+		// Null unless enableFastMem has been called
+		std::unique_ptr<FastMem> fastmem;
+		WriteWatcher* watcher;
+
+		void updatePage(uint8_t page);
+		void updateFastMem(uint8_t page);
+		// Work out reported from scratch, for when what shares memory with
+		// what has changed
+		void updateReported();
+		// Work out aliases from scratch, whenever writable memory is mapped
+		// or unmapped somewhere
+		void updateAliases();
+		// Count a watch of page more or less for all of its aliases
+		void countWatch(uint8_t page, int delta);
+		// Calls f with every page mapped to the same memory as page, page
+		// itself included, going by aliases
+		template<class F> void forEachAlias(uint8_t page, F f);
 	public:
+		MemoryMapper();
+
+		void setWatcher(WriteWatcher* watcher);
+		// Keep an image of the fixed banks that generated code can read
+		// from directly, see FastMem. Moves the fixed RAM into it, so this
+		// has to happen before any code is compiled.
+		void enableFastMem();
+		// Whether every address from start to end can be read through
+		// emitFastLoad without faulting
+		bool isFast(uint16_t start, uint16_t end);
+		// Start or stop reporting stores to a page. Returns false if the page
+		// can't be written, in which case there is nothing to watch.
+		bool watch(uint8_t page, bool enable);
+		void written(uint16_t addr);
+
 		void setBank(uint8_t page, std::shared_ptr<MemoryBank> bank);
+		// Map count pages of bank, starting offset bytes into it, from page
+		// onwards. This is how boards switch banks, so it only swaps page
+		// table entries. Pages that will be switched again later have to be
+		// mapped as switchable.
+		void map(uint8_t page, uint16_t count, std::shared_ptr<MemoryBank> bank, size_t offset, bool switchable);
+		// Map count pages from page onwards to whatever is mapped at the
+		// sourceCount pages starting at source, repeating them as needed.
+		// Later changes to the source pages aren't picked up.
+		void mirror(uint8_t page, uint16_t count, uint8_t source, uint16_t sourceCount);
+		// Send the stores to count pages from page onwards to handler as
+		// well. A null handler detaches whatever was there.
+		void setHandler(uint8_t page, uint16_t count, StoreHandler* handler);
+		PageSource getSource(uint8_t page);
+		// The page tables generated code looks addresses up in. They belong
+		// in the CpuContext.
+		uintptr_t* getReadPages();
+		uintptr_t* getWritePages();
+		bool isSwitchable(uint8_t page);
 		uint8_t getValue(size_t addr);
 		void setValue(size_t addr, uint8_t value);
 
 		void emitLoad(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp dest);
 		void emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src);
 
+		// Accesses through the page tables of the CpuContext in REG_CTX,
+		// with a helper call for the pages that don't have an entry. addr has to hold the guest address zero
+		// extended to 64 bits, rdx, rsi and the caller saved registers are
+		// clobbered.
 		void emitDynamicLoad(asmjit::X86Assembler& a, asmjit::X86Gp addr, asmjit::X86Gp dest);
 		template<class T> void emitDynamicStore(asmjit::X86Assembler& a, asmjit::X86Gp addr, T src);
+		// Like emitDynamicLoad, but a single read from the FastMem region.
+		// Addresses that turn out not to be fast are sent to the slow path
+		// by the fault handler.
+		void emitFastLoad(asmjit::X86Assembler& a, asmjit::X86Gp addr, asmjit::X86Gp dest);
 };
@@ -1,30 +1,49 @@
 #include "mapper/rammemorybank.h"
 
 #include <fmt/format.h>
+#include <string.h>
 
-RamMemoryBank::RamMemoryBank(size_t size) : memory(std::unique_ptr<char>(new char[size])), size(size) {
+RamMemoryBank::RamMemoryBank(size_t size) :
+	memory(std::unique_ptr<char>(new char[size])),
+	data((uint8_t*)memory.get()),
+	size(size) {
 }
 
 uint8_t RamMemoryBank::getValue(size_t addr) {
-	return memory.get()[addr];
+	return data[addr];
 }
 
 void RamMemoryBank::setValue(size_t addr, uint8_t value) {
-	memory.get()[addr] = value;
+	data[addr] = value;
 }
 
 uint16_t RamMemoryBank::getSize() {
 	return size >> 8;
 }
 
+bool RamMemoryBank::isWritable() {
+	return true;
+}
+
+uint8_t* RamMemoryBank::getMemory() {
+	return this->data;
+}
+
+bool RamMemoryBank::relocate(uint8_t* memory) {
+	memcpy(memory, data, size);
+	data = memory;
+	this->memory.reset();
+	return true;
+}
+
 void RamMemoryBank::emitLoad(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp dest) {
 	auto temp = asmjit::x86::rax;
-	a.mov(temp, (uint64_t)this->memory.get() + addr);
+	a.mov(temp, (uint64_t)this->data + addr);
 	a.mov(dest, asmjit::x86::byte_ptr(temp));
 }
 
 void RamMemoryBank::emitStore(asmjit::X86Assembler& a, uint16_t addr, asmjit::X86Gp src) {
 	auto temp = asmjit::x86::rax;
-	a.mov(temp, (uint64_t)this->memory.get() + addr);
+	a.mov(temp, (uint64_t)this->data + addr);
 	a.mov(asmjit::x86::byte_ptr(temp), src);
 }
@@ -7,12 +7,17 @@
 class RamMemoryBank : public MemoryBank {
 	private:
 		std::unique_ptr<char> memory;
+		// Where the contents are, somewhere else once relocated
+		uint8_t* data;
 		size_t size;
 
 	public:
 		RamMemoryBank(size_t size);
 
 		uint16_t getSize();
+		bool isWritable();
+		uint8_t* getMemory();
+		bool relocate(uint8_t* memory);
 
 		uint8_t getValue(size_t addr);
 		void setValue(size_t addr, uint8_t value);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// Hardware that reacts to guest stores, like the bank registers of a
+// cartridge board. Gets every store to the pages it is attached to, after
+// the bank mapped there has seen it.
+class StoreHandler {
+	public:
+		virtual void stored(uint16_t addr, uint8_t value) = 0;
+
+		virtual ~StoreHandler() {};
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+// Gets told about guest writes to pages the MemoryMapper has been asked to
+// watch
+class WriteWatcher {
+	public:
+		virtual void written(uint16_t addr) = 0;
+		// Something else is mapped at count pages from page onwards now
+		virtual void mapped(uint8_t page, uint16_t count) {};
+
+		virtual ~WriteWatcher() {};
+};
@@ -0,0 +1,322 @@
+#include "optimizer.h"
+
+#include <algorithm>
+
+#include "registers.h"
+
+namespace {
+	struct Value {
+		bool known;
+		uint8_t value;
+	};
+}
+
+// What is left of an instruction folded away completely. It only holds on
+// to the cycles until removeNops.
+static IrInstr makeNop(const IrInstr& from) {
+	IrInstr instr = from;
+	instr.op = IrOp::NOP;
+	instr.dst = IR_NONE;
+	instr.src = IR_NONE;
+	instr.src2 = IR_NONE;
+	instr.flags = 0;
+	return instr;
+}
+
+static IrInstr makeSetFlag(const IrInstr& from, int flag, bool value) {
+	IrInstr instr = makeNop(from);
+	instr.op = IrOp::SET_FLAG;
+	instr.flag = flag;
+	instr.value = value;
+	instr.cycles = 0;
+	return instr;
+}
+
+void propagateConstants(IrBlock& block) {
+	Value regs[IR_NONE] = {};
+	Value flags[8] = {};
+	std::vector<IrInstr> out;
+
+	// Record the flags an instruction defines, as statically known values if
+	// we have them, and emit them as such in place of the instruction
+	auto foldFlags = [&](const IrInstr& instr, uint8_t known, uint8_t values) {
+		for(int flag = 0; flag < 8; flag++) {
+			if(!((instr.flags >> flag) & 1))
+				continue;
+			flags[flag].known = (known >> flag) & 1;
+			flags[flag].value = (values >> flag) & 1;
+		}
+	};
+	auto nz = [](uint8_t value) -> uint8_t {
+		return (value == 0 ? 1 << S_ZERO : 0) | (value & 0x80 ? 1 << S_NEGATIVE : 0);
+	};
+
+	for(auto instr : block.instrs) {
+		// Registers we know become immediates
+		switch(instr.op) {
+			case IrOp::AND:
+			case IrOp::OR:
+			case IrOp::XOR:
+			case IrOp::CMP:
+			case IrOp::TEST:
+			case IrOp::PUSH:
+				if(instr.src != IR_NONE && regs[instr.src].known) {
+					instr.imm = regs[instr.src].value;
+					instr.src = IR_NONE;
+				}
+				break;
+			default:
+				break;
+		}
+
+		bool done = false;
+		switch(instr.op) {
+			case IrOp::LOAD_IMM:
+				regs[instr.dst] = {true, (uint8_t)instr.imm};
+				foldFlags(instr, 0xFF, nz(instr.imm));
+				break;
+			case IrOp::MOV:
+				if(regs[instr.src].known) {
+					instr.op = IrOp::LOAD_IMM;
+					instr.imm = regs[instr.src].value;
+					instr.src = IR_NONE;
+					regs[instr.dst] = {true, (uint8_t)instr.imm};
+					foldFlags(instr, 0xFF, nz(instr.imm));
+				} else {
+					regs[instr.dst].known = false;
+					foldFlags(instr, 0, 0);
+				}
+				break;
+			case IrOp::AND:
+			case IrOp::OR:
+			case IrOp::XOR:
+				if(instr.src == IR_NONE && regs[instr.dst].known) {
+					uint8_t value = regs[instr.dst].value;
+					if(instr.op == IrOp::AND) value &= instr.imm;
+					if(instr.op == IrOp::OR)  value |= instr.imm;
+					if(instr.op == IrOp::XOR) value ^= instr.imm;
+					instr.op = IrOp::LOAD_IMM;
+					instr.imm = value;
+					regs[instr.dst] = {true, value};
+					foldFlags(instr, 0xFF, nz(value));
+				} else {
+					regs[instr.dst].known = false;
+					foldFlags(instr, 0, 0);
+				}
+				break;
+			case IrOp::CMP:
+				if(instr.src == IR_NONE && regs[instr.dst].known) {
+					uint8_t a = regs[instr.dst].value;
+					uint8_t b = instr.imm;
+					uint8_t values = nz(a - b) | (a >= b ? 1 << S_CARRY : 0);
+					foldFlags(instr, 0xFF, values);
+					out.push_back(makeNop(instr));
+					for(int flag = 0; flag < 8; flag++) {
+						if((instr.flags >> flag) & 1)
+							out.push_back(makeSetFlag(instr, flag, (values >> flag) & 1));
+					}
+					continue;
+				}
+				foldFlags(instr, 0, 0);
+				break;
+			case IrOp::TEST:
+				if(instr.src == IR_NONE && regs[instr.dst].known) {
+					bool zero = (regs[instr.dst].value & instr.imm) == 0;
+					foldFlags(instr, 0xFF, zero ? 1 << S_ZERO : 0);
+					out.push_back(makeNop(instr));
+					out.push_back(makeSetFlag(instr, S_ZERO, zero));
+					continue;
+				}
+				foldFlags(instr, 0, 0);
+				break;
+			case IrOp::FLAGS_VN:
+				if(regs[instr.src].known) {
+					uint8_t value = regs[instr.src].value;
+					foldFlags(instr, 0xFF, value);
+					out.push_back(makeNop(instr));
+					for(int flag = 0; flag < 8; flag++) {
+						if((instr.flags >> flag) & 1)
+							out.push_back(makeSetFlag(instr, flag, (value >> flag) & 1));
+					}
+					continue;
+				}
+				foldFlags(instr, 0, 0);
+				break;
+			case IrOp::LOAD_IDX:
+			case IrOp::STORE_IDX: {
+				// A known index makes it a plain static access
+				IrReg& index = instr.op == IrOp::LOAD_IDX ? instr.src : instr.src2;
+				if(regs[index].known) {
+					// Whether the load crosses a page is known now too
+					if(instr.op == IrOp::LOAD_IDX && (instr.imm & 0xFF) + regs[index].value > 0xFF)
+						instr.cycles++;
+					instr.imm = (uint16_t)(instr.imm + regs[index].value);
+					instr.op = instr.op == IrOp::LOAD_IDX ? IrOp::LOAD : IrOp::STORE;
+					index = IR_NONE;
+				}
+				if(instr.op == IrOp::LOAD || instr.op == IrOp::LOAD_IDX) {
+					regs[instr.dst].known = false;
+					foldFlags(instr, 0, 0);
+				}
+				break;
+			}
+			case IrOp::LOAD:
+			case IrOp::POP:
+				regs[instr.dst].known = false;
+				foldFlags(instr, 0, 0);
+				break;
+			case IrOp::POP_FLAGS:
+				for(auto& flag : flags)
+					flag.known = false;
+				break;
+			case IrOp::SET_FLAG:
+				flags[instr.flag] = {true, instr.value};
+				break;
+			case IrOp::LABEL:
+				// Whatever we knew doesn't hold when we come around again
+				for(auto& reg : regs)
+					reg.known = false;
+				for(auto& flag : flags)
+					flag.known = false;
+				break;
+			case IrOp::BRANCH:
+				if(flags[instr.flag].known) {
+					// Never taken, just fall through
+					if((flags[instr.flag].value != 0) != instr.value) {
+						out.push_back(makeNop(instr));
+						continue;
+					}
+					// Always taken, which costs what the backend would add
+					// for a taken BRANCH
+					instr.cycles += (instr.target & 0xFF00) != ((instr.location + 2) & 0xFF00) ? 2 : 1;
+					instr.op = IrOp::JUMP;
+					done = true;
+				}
+				break;
+			case IrOp::JUMP:
+			case IrOp::JUMP_IND:
+				done = true;
+				break;
+			default:
+				break;
+		}
+
+		out.push_back(instr);
+		// Nothing after an unconditional exit can run
+		if(done)
+			break;
+	}
+
+	block.instrs = std::move(out);
+}
+
+void eliminateDeadFlags(IrBlock& block) {
+	// Whatever we jump to might look at any of them
+	uint8_t live = 0xFF;
+	for(auto it = block.instrs.rbegin(); it != block.instrs.rend(); it++) {
+		auto& instr = *it;
+		uint8_t read = instr.flagsRead();
+		uint8_t written = instr.flagsWritten();
+
+		instr.flags &= live;
+		switch(instr.op) {
+			case IrOp::CMP:
+			case IrOp::TEST:
+			case IrOp::FLAGS_VN:
+				// Nothing but flags
+				if(instr.flags == 0)
+					instr.op = IrOp::NOP;
+				break;
+			case IrOp::SET_FLAG:
+				if((live & written) == 0)
+					instr.op = IrOp::NOP;
+				break;
+			default:
+				break;
+		}
+
+		live = (live & ~written) | read;
+	}
+}
+
+void eliminateDeadWrites(IrBlock& block) {
+	// The guest registers are visible to whatever comes after the block, the
+	// temporaries are not
+	const uint8_t guest = (1 << IR_A) | (1 << IR_X) | (1 << IR_Y) | (1 << IR_SP);
+	auto bit = [](IrReg reg) -> uint8_t {
+		return reg == IR_NONE ? 0 : 1 << reg;
+	};
+
+	uint8_t live = guest;
+	for(auto it = block.instrs.rbegin(); it != block.instrs.rend(); it++) {
+		auto& instr = *it;
+		switch(instr.op) {
+			case IrOp::LOAD_IMM:
+			case IrOp::MOV:
+			case IrOp::AND:
+			case IrOp::OR:
+			case IrOp::XOR:
+				// Only registers and flags, so it's dead if both are
+				if(!(live & bit(instr.dst)) && instr.flags == 0) {
+					instr.op = IrOp::NOP;
+					continue;
+				}
+				live &= ~bit(instr.dst);
+				live |= bit(instr.src);
+				if(instr.op != IrOp::LOAD_IMM && instr.op != IrOp::MOV)
+					live |= bit(instr.dst);
+				break;
+			case IrOp::LOAD:
+			case IrOp::LOAD_IDX:
+				// Reads can have side effects, so they stay
+				live &= ~bit(instr.dst);
+				live |= bit(instr.src);
+				break;
+			case IrOp::POP:
+				live &= ~bit(instr.dst);
+				live |= bit(IR_SP);
+				break;
+			case IrOp::PUSH:
+			case IrOp::PUSH_FLAGS:
+			case IrOp::POP_FLAGS:
+				live |= bit(instr.src) | bit(IR_SP);
+				break;
+			case IrOp::BRANCH:
+			case IrOp::JUMP:
+			case IrOp::JUMP_IND:
+				live |= guest | bit(instr.src) | bit(instr.src2);
+				break;
+			default:
+				live |= bit(instr.dst) | bit(instr.src) | bit(instr.src2);
+				break;
+		}
+	}
+}
+
+void removeNops(IrBlock& block) {
+	auto& instrs = block.instrs;
+	// The time the guest instructions take doesn't go away with them
+	uint16_t carried = 0;
+	for(auto& instr : instrs) {
+		if(instr.op == IrOp::NOP) {
+			carried += instr.cycles;
+			instr.cycles = 0;
+		} else {
+			instr.cycles += carried;
+			carried = 0;
+		}
+	}
+	instrs.erase(
+		std::remove_if(instrs.begin(), instrs.end(), [](const IrInstr& instr) {
+			return instr.op == IrOp::NOP;
+		}),
+		instrs.end()
+	);
+}
+
+void optimize(IrBlock& block) {
+	propagateConstants(block);
+	eliminateDeadFlags(block);
+	eliminateDeadWrites(block);
+	removeNops(block);
+}
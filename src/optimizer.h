@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ir.h"
+
+// Track the values of registers and flags known at compile time. Operations
+// on them are folded, and branches on known flags become jumps or vanish.
+void propagateConstants(IrBlock& block);
+
+// Clear the flags nobody reads before they are redefined, and drop anything
+// that only computed those
+void eliminateDeadFlags(IrBlock& block);
+
+// Drop register writes that are overwritten before anyone reads them
+void eliminateDeadWrites(IrBlock& block);
+
+// Remove the NOPs left behind by the other passes
+void removeNops(IrBlock& block);
+
+// Run every pass over a freshly lowered block
+void optimize(IrBlock& block);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// Bits of the status register
+#define S_CARRY         0
+#define S_ZERO          1
+#define S_INTER_DISABLE 2
+#define S_DECIMAL       3
+#define S_INTERRUPT     4
+#define S_ALWAYS        5
+#define S_OVERFLOW      6
+#define S_NEGATIVE      7
+
+// Bits of CpuContext::pending. The NMI is taken once per edge, the IRQ
+// line stays asserted until whoever raised it lets go.
+#define INT_NMI 0
+#define INT_IRQ 1
+
+// Everything about the guest CPU, in a single cache line. Generated code
+// addresses it through REG_CTX.
+// Careful here. The registers are written to directly from the assembly
+// wrapper, so the offsets have to match fun.S.
+struct alignas(64) CpuContext {
+	uint8_t sp;
+	uint8_t s;
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	// Where generated code keeps the IR temporaries across helper calls
+	uint8_t spill[2];
+	// Interrupts waiting to be taken
+	uint8_t pending;
+	// Where the guest continues whenever generated code isn't running
+	uint16_t pc;
+	// The CPU cycle at which something outside of it needs to be looked at
+	// next. The cycle we're at is deadline - budget.
+	uint64_t deadline;
+	// Cycles left until the deadline. Counted down by generated code, which
+	// leaves at the next exit once it is used up.
+	int64_t budget;
+	// The MemoryMapper page tables, see emitDynamicLoad
+	uintptr_t* readPages;
+	uintptr_t* writePages;
+};
@@ -0,0 +1,76 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Most CPU cycles run in one go when nothing is scheduled, roughly a frame
+#define MAX_SLICE 29781
+
+Scheduler::Scheduler(uint32_t latency) : handlers(), serials(), latency(latency) {
+}
+
+void Scheduler::setHandler(Event event, EventHandler* handler) {
+	handlers[event] = handler;
+}
+
+// Orders the heap so the earliest entry is at the front
+bool Scheduler::later(const Entry& a, const Entry& b) {
+	return a.time > b.time;
+}
+
+bool Scheduler::stale(const Entry& entry) {
+	return entry.serial != serials[entry.event];
+}
+
+void Scheduler::pop() {
+	std::pop_heap(heap.begin(), heap.end(), later);
+	heap.pop_back();
+}
+
+void Scheduler::schedule(Event event, uint64_t time) {
+	if(handlers[event] == nullptr)
+		throw std::logic_error("Scheduled an event nobody handles");
+	heap.push_back({time, event, ++serials[event]});
+	std::push_heap(heap.begin(), heap.end(), later);
+}
+
+void Scheduler::cancel(Event event) {
+	serials[event]++;
+}
+
+uint64_t Scheduler::now(const CpuContext& cpu) {
+	return (cpu.deadline - cpu.budget) * MASTER_PER_CPU;
+}
+
+void Scheduler::run(CpuContext& cpu) {
+	// The budget is usually a few cycles below zero here rather than at
+	// zero, the exit that noticed it only checks after the instructions in
+	// front of it
+	uint64_t cycle = cpu.deadline - cpu.budget;
+	uint64_t master = cycle * MASTER_PER_CPU;
+
+	while(!heap.empty()) {
+		Entry next = heap.front();
+		if(!stale(next) && next.time > master)
+			break;
+		pop();
+		if(stale(next))
+			continue;
+		// Done with, a handler rescheduling it gets a fresh entry
+		serials[next.event]++;
+		handlers[next.event]->fire(next.event, next.time);
+	}
+
+	uint64_t deadline = cycle + MAX_SLICE;
+	if(!heap.empty()) {
+		// Rounded up, the CPU can only stop between cycles
+		uint64_t due = (heap.front().time + MASTER_PER_CPU - 1) / MASTER_PER_CPU;
+		deadline = std::min(deadline, due);
+	}
+	// Generated code doesn't notice the I flag being cleared, it has to come
+	// back and look every now and then
+	if(cpu.pending != 0)
+		deadline = std::min(deadline, cycle + std::max(latency, 1u));
+	cpu.deadline = deadline;
+	cpu.budget = deadline - cycle;
+}
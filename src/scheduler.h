@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "registers.h"
+
+// NTSC master clock ticks per CPU cycle and per PPU dot
+#define MASTER_PER_CPU 12
+#define MASTER_PER_DOT 4
+
+// Things outside of the CPU that happen at a known time
+enum Event {
+	EVENT_VBLANK,    // The PPU enters the vertical blank
+	EVENT_APU_FRAME, // The APU frame counter reaches the end of its sequence
+	EVENT_COUNT
+};
+
+// Whoever emulates the hardware an Event belongs to
+class EventHandler {
+	public:
+		// time is the master clock time the event was scheduled for. The
+		// CPU is usually a little past it.
+		virtual void fire(Event event, uint64_t time) = 0;
+
+		virtual ~EventHandler() {};
+};
+
+// Keeps the upcoming events in a min-heap on their master clock time, and
+// lets the CPU run without looking at anything else until the first of
+// them is due. The CPU side of that is the budget in the CpuContext.
+class Scheduler {
+	private:
+		struct Entry {
+			uint64_t time;
+			Event event;
+			// Entries of an event that has been rescheduled or cancelled
+			// since are left in the heap and skipped once they come up
+			uint32_t serial;
+		};
+		std::vector<Entry> heap;
+		EventHandler* handlers[EVENT_COUNT];
+		uint32_t serials[EVENT_COUNT];
+		// Most cycles the CPU runs before it looks at a masked IRQ again
+		uint32_t latency;
+
+		static bool later(const Entry& a, const Entry& b);
+		bool stale(const Entry& entry);
+		void pop();
+	public:
+		Scheduler(uint32_t latency);
+
+		void setHandler(Event event, EventHandler* handler);
+		// Have the event fire at the master clock time. Anything scheduled
+		// for it before is forgotten, every event is pending at most once.
+		void schedule(Event event, uint64_t time);
+		void cancel(Event event);
+
+		// Fire every event that is due at the cycle the CPU is at, then give
+		// it the budget up to the next one. Interrupts the events raise are
+		// left pending in the CpuContext.
+		void run(CpuContext& cpu);
+		// Master clock time of the cycle the CPU is at
+		static uint64_t now(const CpuContext& cpu);
+};